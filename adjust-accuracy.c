@@ -0,0 +1,217 @@
+/*
+
+  adjust-accuracy :: compare every adjust_channels() implementation with the exact result
+
+  Each supported implementation adjusts all 256 values of each channel with
+  every factor on a grid from 0.0 to 2.0 (by default in steps of 1/512),
+  and each result is compared with the exact value v * factor (clamped to
+  255). The red, green and blue channels get different factors from the
+  grid in each pass, so a factor applied to the wrong channel shows up too.
+
+  For each implementation, one line of CSV is written to stdout: the
+  maximum and mean absolute error, the mean signed error (negative for
+  implementations that truncate), and the percentage of results that are
+  identical to those of #1.
+
+  With --matrix, each implementation that has a kernel for colour matrices
+  (see adjust_ops.c) instead applies a set of matrices plus bias - white
+  balance, saturation, sepia, RGB to YCbCr and back - to a grid of RGB
+  values (every 'steps'-th value of each channel, by default 5), and the
+  results are compared with the exact sum, clamped to 0-255.
+
+  (C)2022 Seneca College of Applied Arts and Technology.
+  Written by Chris Tyler. Licensed under the terms of the GPL verion 2.
+
+*/
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/param.h>
+
+#include "adjust_channels.h"
+
+#define VALUES		256		// pixels in the test image: (v, v, v) for every 8-bit v
+
+// Fill the test image and adjust it with one implementation
+static void run(int number, const float *factor, unsigned char *image) {
+	struct adjust_plan *plan = adjust_plan_create(factor[0], factor[1], factor[2], 3, ADJUST_PLAN_IMPL(number));
+
+	for (int v = 0; v < VALUES; v++) {
+		image[v * 3] = image[v * 3 + 1] = image[v * 3 + 2] = v;
+	}
+	adjust_plan_execute(plan, image, VALUES, 1);
+	adjust_plan_destroy(plan);
+}
+
+// Matrices and biases for --matrix (see adjust_plan_create_matrix())
+static const struct {
+	const char	*name;
+	float		matrix[9], bias[3];
+} matrix_sets[] = {
+	{ "white balance", { 0.8, 0, 0, 0, 1.2, 0, 0, 0, 1.5 }, { 0, 0, 0 } },
+	{ "saturation 1.3", { 1.2103, -0.1761, -0.0342, -0.0897, 1.1239, -0.0342, -0.0897, -0.1761, 1.2658 },
+		{ 0, 0, 0 } },
+	{ "sepia", { 0.393, 0.769, 0.189, 0.349, 0.686, 0.168, 0.272, 0.534, 0.131 }, { 0, 0, 0 } },
+	{ "rgb to ycbcr", { 0.299, 0.587, 0.114, -0.168736, -0.331264, 0.5, 0.5, -0.418688, -0.081312 },
+		{ 0, 128, 128 } },
+	{ "ycbcr to rgb", { 1, 0, 1.402, 1, -0.344136, -0.714136, 1, 1.772, 0 }, { -179.456, 135.459, -226.816 } },
+};
+
+// Compare each implementation's colour matrix kernel with the exact result
+static void matrix_accuracy(const char *impl, int steps) {
+	int per_channel = (255 + steps - 1) / steps + 1;	// values 0, steps, 2 * steps ... and 255
+	size_t pixels = (size_t)per_channel * per_channel * per_channel;
+	unsigned char *grid = malloc(pixels * 3), *image = malloc(pixels * 3), *reference = malloc(pixels * 3);
+	size_t p = 0;
+
+	for (int r = 0; r < per_channel; r++) {
+		for (int g = 0; g < per_channel; g++) {
+			for (int b = 0; b < per_channel; b++, p++) {
+				grid[p * 3] = MIN(r * steps, 255);
+				grid[p * 3 + 1] = MIN(g * steps, 255);
+				grid[p * 3 + 2] = MIN(b * steps, 255);
+			}
+		}
+	}
+
+	printf("impl,impl_name,matrix,samples,max_error,mean_error,mean_signed_error,pct_same_as_1\n");
+
+	for (int m = 0; m < adjust_implementation_count; m++) {
+		const struct adjust_implementation *impl_m = &adjust_implementations[m];
+		char number[16];
+
+		snprintf(number, sizeof(number), "%d", impl_m->number);
+		if (!impl_m->supported() || impl_m->fused == NULL || (strcmp(impl, "all") != 0 &&
+		    strcmp(impl, impl_m->name) != 0 && strcmp(impl, number) != 0)) {
+			continue;
+		}
+
+		for (int k = 0; k < sizeof(matrix_sets) / sizeof(matrix_sets[0]); k++) {
+			const float *a = matrix_sets[k].matrix, *bias = matrix_sets[k].bias;
+			struct adjust_plan *plan = adjust_plan_create_matrix(a, bias, ADJUST_PLAN_IMPL(impl_m->number));
+			struct adjust_plan *plan1 = adjust_plan_create_matrix(a, bias, ADJUST_PLAN_IMPL(1));
+			double max_error = 0, sum_error = 0, sum_signed = 0;
+			long same = 0;
+
+			memcpy(image, grid, pixels * 3);
+			memcpy(reference, grid, pixels * 3);
+			adjust_plan_execute(plan, image, pixels, 1);
+			adjust_plan_execute(plan1, reference, pixels, 1);
+
+			for (p = 0; p < pixels; p++) {
+				const unsigned char *in = grid + p * 3;
+
+				for (int c = 0; c < 3; c++) {
+					double exact = bias[c] + (double)a[c * 3] * in[0] + (double)a[c * 3 + 1] * in[1] +
+						(double)a[c * 3 + 2] * in[2];
+					double error = image[p * 3 + c] - MIN(MAX(exact, 0), 255);
+
+					max_error = MAX(max_error, fabs(error));
+					sum_error += fabs(error);
+					sum_signed += error;
+					same += image[p * 3 + c] == reference[p * 3 + c];
+				}
+			}
+			printf("%d,\"%s\",\"%s\",%zu,%.4f,%.4f,%.4f,%.2f\n", impl_m->number, impl_m->name,
+				matrix_sets[k].name, pixels * 3, max_error, sum_error / (pixels * 3),
+				sum_signed / (pixels * 3), 100.0 * same / (pixels * 3));
+			fflush(stdout);
+			adjust_plan_destroy(plan);
+			adjust_plan_destroy(plan1);
+		}
+	}
+	free(grid);
+	free(image);
+	free(reference);
+}
+
+static void usage(char *name) {
+	dprintf(2, "\nUsage: %s [--impl=N|name|all] [--steps=N] [--matrix]\n", name);
+	dprintf(2, "where --steps is the number of factor steps per 1.0 (default 512), or with --matrix,\n"
+		"the step between the values tested in each channel (default 5)\n");
+}
+
+int main(int argc, char *argv[]) {
+
+	// ==================== Process options
+	const char *impl = "all";
+	int steps = 0;
+	int matrix = 0;
+
+	for (int i = 1; i < argc; i++) {
+		if (strncmp(argv[i], "--impl=", 7) == 0) {
+			impl = argv[i] + 7;
+		} else if (strncmp(argv[i], "--steps=", 8) == 0) {
+			steps = atoi(argv[i] + 8);
+		} else if (strcmp(argv[i], "--matrix") == 0) {
+			matrix = 1;
+		} else {
+			usage(argv[0]);
+			return 1;
+		}
+	}
+	if (steps == 0) {
+		steps = matrix ? 5 : 512;
+	}
+	if (steps < 1) {
+		usage(argv[0]);
+		return 1;
+	}
+	if (matrix) {
+		matrix_accuracy(impl, steps);
+		return 0;
+	}
+
+	int factors = 2 * steps + 1;		// grid of factors, 0.0 - 2.0 inclusive
+	unsigned char image[VALUES * 3];
+	unsigned char reference[VALUES * 3];
+
+	printf("impl,impl_name,factors,samples,max_error,mean_error,mean_signed_error,pct_same_as_1\n");
+
+	for (int m = 0; m < adjust_implementation_count; m++) {
+		const struct adjust_implementation *impl_m = &adjust_implementations[m];
+		char number[16];
+
+		snprintf(number, sizeof(number), "%d", impl_m->number);
+		if (!impl_m->supported() || (strcmp(impl, "all") != 0 &&
+		    strcmp(impl, impl_m->name) != 0 && strcmp(impl, number) != 0)) {
+			continue;
+		}
+
+		double max_error = 0, sum_error = 0, sum_signed = 0;
+		long samples = 0, same = 0;
+
+		for (int k = 0; k < factors; k++) {
+
+			// Each channel gets a different factor, a third of the grid apart
+			float factor[3] = {
+				(float)k / steps,
+				(float)((k + factors / 3) % factors) / steps,
+				(float)((k + 2 * factors / 3) % factors) / steps,
+			};
+
+			run(1, factor, reference);
+			run(impl_m->number, factor, image);
+
+			for (int v = 0; v < VALUES; v++) {
+				for (int c = 0; c < 3; c++) {
+					double exact = MIN(v * (double)factor[c], 255);
+					double error = image[v * 3 + c] - exact;
+
+					max_error = MAX(max_error, fabs(error));
+					sum_error += fabs(error);
+					sum_signed += error;
+					same += image[v * 3 + c] == reference[v * 3 + c];
+					samples++;
+				}
+			}
+		}
+
+		printf("%d,\"%s\",%d,%ld,%.4f,%.4f,%.4f,%.2f\n", impl_m->number, impl_m->name, factors, samples,
+			max_error, sum_error / samples, sum_signed / samples, 100.0 * same / samples);
+		fflush(stdout);
+	}
+	return 0;
+}
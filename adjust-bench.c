@@ -0,0 +1,323 @@
+/*
+
+  adjust-bench :: in-process benchmark for the adjust_channels() implementations
+  
+  Unlike the all-test target in the Makefile, which times a whole
+  image-adjust process (mostly JPEG decoding and encoding), this times
+  only the calls to adjust_channels(), on synthetic images in a range of
+  sizes chosen to sit in L1, L2, the last-level cache, and DRAM.
+  
+  Every supported implementation is run with each factor set (using a
+  plan created beforehand, so setup is not timed); after a number of
+  warmup calls, each repeat is timed separately and the
+  min/median/99th-percentile times are reported as CSV on stdout.
+  Then each factor set is run once more with the plan left free to
+  choose a fast path ("planned" in the impl_name column, followed by
+  the kernel that was chosen).
+  
+  With --matrix, the factor sets are replaced by colour matrices (white
+  balance, channel mixing, RGB to YCbCr and back - see adjust_ops.c),
+  run with each implementation that has a kernel for them (8-bit RGB).
+  
+  With --stats, each size instead times the statistics pass for
+  automatic white balance (see adjust_stats.c) - over every row, and
+  over the rows it samples by default - next to the planned adjust pass
+  that it comes before (impl 0 in the CSV, and only the image is read).
+  Unlike the kernels, counting depends on the data: runs of equal
+  values are slower, so it is timed on the random image and again on a
+  constant one, as the best and worst cases.
+  
+  With --hugepages, the images are allocated with adjust_alloc(): 2MB
+  or 1GB pages from the hugetlbfs pool (--hugepages=2m or 1g), or
+  transparent huge pages (plain --hugepages), to compare TLB costs.
+  
+  (C)2022 Seneca College of Applied Arts and Technology.
+  Written by Chris Tyler. Licensed under the terms of the GPL verion 2.
+  
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+
+#include "adjust_channels.h"
+
+// Image sizes to benchmark (the byte counts are for 3 bytes per pixel)
+static const struct {
+	const char	*name;
+	int		x, y;
+} sizes[] = {
+	{ "tiny",   32,   32 },		//   3 KB
+	{ "l1",     96,   96 },		//  27 KB
+	{ "l2",    384,  384 },		// 432 KB
+	{ "llc",  1280, 1280 },		// 4.7 MB
+	{ "dram", 6000, 6000 },		// 103 MB
+};
+
+// Factor sets (the first three are the ones used by the all-test target)
+static const struct {
+	const char	*name;
+	float		r, g, b;
+} factor_sets[] = {
+	{ "1.0/1.0/1.0", 1.0, 1.0, 1.0 },
+	{ "0.5/0.5/0.5", 0.5, 0.5, 0.5 },
+	{ "2.0/2.0/2.0", 2.0, 2.0, 2.0 },
+	{ "0.8/1.2/1.5", 0.8, 1.2, 1.5 },
+	{ "1.0/0.5/2.0", 1.0, 0.5, 2.0 },
+	{ "1.0/1.0/0.8", 1.0, 1.0, 0.8 },
+	{ "0.25/0.25/0.25", 0.25, 0.25, 0.25 },
+};
+
+// Colour matrices for --matrix, as operation lists (see adjust_ops_parse())
+static const struct {
+	const char	*name;
+	const char	*ops;
+} matrix_sets[] = {
+	{ "white balance", "matrix=0.8:0:0:0:1.2:0:0:0:1.5" },
+	{ "saturation 1.3", "saturation=1.3" },
+	{ "sepia", "matrix=0.393:0.769:0.189:0.349:0.686:0.168:0.272:0.534:0.131" },
+	{ "rgb to ycbcr", "ycbcr" },
+	{ "ycbcr to rgb", "rgb" },
+	{ "gamma/mix/gamma", "gamma=0.45,saturation=1.3,gamma=2.2" },
+};
+
+#define COUNT(a)	(sizeof(a) / sizeof((a)[0]))
+
+// Each timed sample calls adjust_channels() enough times to cover at least this many pixels,
+// so that samples on the small images are long enough to time accurately
+#define SAMPLE_PIXELS	(1024 * 1024)
+
+static uint64_t now_ns(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static int compare_u64(const void *a, const void *b) {
+	uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+	return (x > y) - (x < y);
+}
+
+// Options
+static int threads = 1;
+static int channels = 3;
+static int bits = 8;
+static int warmup = 3;
+static int repeats = 25;
+static int hugepages = -1;		// -1: aligned_alloc(); otherwise adjust_alloc() flags
+static int matrix = 0;
+static int stats = 0;
+
+// Fill an image with pseudo-random bytes (a simple LCG - deterministic, with no pattern the
+// kernels care about)
+static void fill_random(unsigned char *image, size_t bytes) {
+	uint32_t seed = 12345;
+
+	for (size_t i = 0; i < bytes; i++) {
+		seed = seed * 1103515245 + 12345;
+		image[i] = seed >> 24;
+	}
+}
+
+// Run a plan on the image, or if 'plan' is NULL count its statistics over every 'step'th row
+static void run(const struct adjust_plan *plan, int step, unsigned char *image, int x, int y) {
+	struct adjust_stats s;
+
+	if (plan != NULL) {
+		adjust_plan_execute(plan, image, x, y);
+	} else {
+		adjust_image_stats(image, x, y, channels, step, bits == 16 ? ADJUST_PLAN_16BIT : 0, &s);
+	}
+}
+
+// Time one plan (or the statistics pass) on one image and print a line of CSV
+static void bench(const struct adjust_plan *plan, int step, const char *impl_name, const char *size_name,
+	const char *factors, unsigned char *image, int x, int y) {
+
+	static uint64_t *samples = NULL;
+	size_t bytes = (size_t)x * y * channels * (bits / 8);
+	int calls = SAMPLE_PIXELS / (x * y);
+
+	if (calls < 1) {
+		calls = 1;
+	}
+	if (samples == NULL) {
+		samples = malloc(repeats * sizeof(uint64_t));
+	}
+
+	// ========== Warm up (caches, page faults, thread pool)
+	for (int w = 0; w < warmup; w++) {
+		run(plan, step, image, x, y);
+	}
+
+	// ========== Timed repeats
+	// (the image is adjusted in place each time; the kernels' timing doesn't depend on the data,
+	// and the statistics pass, whose timing does, leaves the image as it is)
+	for (int rep = 0; rep < repeats; rep++) {
+		uint64_t start = now_ns();
+		for (int c = 0; c < calls; c++) {
+			run(plan, step, image, x, y);
+		}
+		samples[rep] = (now_ns() - start) / calls;
+	}
+	qsort(samples, repeats, sizeof(uint64_t), compare_u64);
+
+	uint64_t min = samples[0];
+	uint64_t median = samples[repeats / 2];
+	uint64_t p99 = samples[(repeats * 99 - 1) / 100];
+
+	// each byte is read once and written once (the statistics pass only reads)
+	printf("%s,%d,%d,%d,%d,%d,%d,\"%s\",%d,%s,%d,%llu,%llu,%llu,%.4f,%.3f\n",
+		size_name, x, y, x * y, channels, bits, plan != NULL ? adjust_plan_implementation(plan)->number : 0,
+		impl_name, threads, factors, repeats,
+		(unsigned long long)min, (unsigned long long)median, (unsigned long long)p99,
+		(double)median / (x * y), median > 0 ? (plan != NULL ? 2.0 : 1.0) * bytes / median : 0.0);
+	fflush(stdout);
+}
+
+static void usage(char *name) {
+	dprintf(2, "\nUsage: %s [--impl=N|name|all] [--threads=N] [--channels=1-4] [--bits=8|16] [--warmup=N] [--repeats=N] [--size=name|all]\n"
+		"\t[--hugepages[=2m|1g]] [--matrix|--stats]\n", name);
+	dprintf(2, "Sizes: ");
+	for (int s = 0; s < COUNT(sizes); s++) {
+		dprintf(2, "%s (%dx%d)%s", sizes[s].name, sizes[s].x, sizes[s].y, s + 1 < COUNT(sizes) ? ", " : "\n");
+	}
+}
+
+int main(int argc, char *argv[]) {
+
+	// ==================== Process options
+	const char *impl = "all";
+	const char *size = "all";
+
+	for (int i = 1; i < argc; i++) {
+		if (strncmp(argv[i], "--impl=", 7) == 0) {
+			impl = argv[i] + 7;
+		} else if (strncmp(argv[i], "--threads=", 10) == 0) {
+			threads = atoi(argv[i] + 10);
+		} else if (strncmp(argv[i], "--channels=", 11) == 0) {
+			channels = atoi(argv[i] + 11);
+		} else if (strncmp(argv[i], "--bits=", 7) == 0) {
+			bits = atoi(argv[i] + 7);
+		} else if (strncmp(argv[i], "--warmup=", 9) == 0) {
+			warmup = atoi(argv[i] + 9);
+		} else if (strncmp(argv[i], "--repeats=", 10) == 0) {
+			repeats = atoi(argv[i] + 10);
+		} else if (strncmp(argv[i], "--size=", 7) == 0) {
+			size = argv[i] + 7;
+		} else if (strcmp(argv[i], "--hugepages") == 0) {
+			hugepages = 0;
+		} else if (strcmp(argv[i], "--hugepages=2m") == 0) {
+			hugepages = ADJUST_ALLOC_HUGE_2M;
+		} else if (strcmp(argv[i], "--hugepages=1g") == 0) {
+			hugepages = ADJUST_ALLOC_HUGE_1G;
+		} else if (strcmp(argv[i], "--matrix") == 0) {
+			matrix = 1;
+		} else if (strcmp(argv[i], "--stats") == 0) {
+			stats = 1;
+		} else {
+			usage(argv[0]);
+			return 1;
+		}
+	}
+	if (repeats < 1 || channels < 1 || channels > 4 || (bits != 8 && bits != 16) ||
+	    (matrix && (channels != 3 || bits != 8)) || (matrix && stats)) {
+		usage(argv[0]);
+		return 1;
+	}
+	threads = adjust_set_threads(threads);
+
+	int plan_bits = bits == 16 ? ADJUST_PLAN_16BIT : 0;
+
+	printf("size,width,height,pixels,channels,bits,impl,impl_name,threads,factors,repeats,"
+		"min_ns,median_ns,p99_ns,ns_per_pixel,gb_per_s\n");
+
+	for (int s = 0; s < COUNT(sizes); s++) {
+		if (strcmp(size, "all") != 0 && strcmp(size, sizes[s].name) != 0) {
+			continue;
+		}
+
+		// ==================== Build a synthetic image
+		int x = sizes[s].x, y = sizes[s].y;
+		size_t bytes = (size_t)x * y * channels * (bits / 8);
+		unsigned char *image = hugepages < 0 ? aligned_alloc(64, (bytes + 63) / 64 * 64) :
+			adjust_alloc(bytes, hugepages);
+
+		if (image == NULL) {
+			dprintf(2, "Could not allocate %zu bytes for the %s image.\n", bytes, sizes[s].name);
+			return 2;
+		}
+		fill_random(image, bytes);
+
+		for (int m = 0; m < adjust_implementation_count; m++) {
+			const struct adjust_implementation *impl_m = &adjust_implementations[m];
+			char number[16];
+
+			snprintf(number, sizeof(number), "%d", impl_m->number);
+			// (implementations that only handle 8-bit RGB would just fall back to another one)
+			if (stats || !impl_m->supported() || (channels != 3 && !(impl_m->flags & ADJUST_ANY_CHANNELS)) ||
+			    (bits == 16 && impl_m->kernel16 == NULL) || (matrix && impl_m->fused == NULL) ||
+			    (strcmp(impl, "all") != 0 &&
+			    strcmp(impl, impl_m->name) != 0 && strcmp(impl, number) != 0)) {
+				continue;
+			}
+
+			for (int f = 0; matrix && f < COUNT(matrix_sets); f++) {
+				struct adjust_ops *ops = adjust_ops_create();
+				struct adjust_plan *plan;
+
+				adjust_ops_parse(ops, matrix_sets[f].ops);
+				plan = adjust_ops_plan(ops, ADJUST_PLAN_IMPL(impl_m->number));
+				bench(plan, 0, impl_m->name, sizes[s].name, matrix_sets[f].name, image, x, y);
+				adjust_plan_destroy(plan);
+				adjust_ops_destroy(ops);
+			}
+			for (int f = 0; !matrix && f < COUNT(factor_sets); f++) {
+				struct adjust_plan *plan = adjust_plan_create(factor_sets[f].r, factor_sets[f].g,
+					factor_sets[f].b, channels, ADJUST_PLAN_IMPL(impl_m->number) | plan_bits);
+
+				bench(plan, 0, impl_m->name, sizes[s].name, factor_sets[f].name, image, x, y);
+				adjust_plan_destroy(plan);
+			}
+		}
+
+		// ==================== Fast paths chosen by the plan
+		if (strcmp(impl, "all") == 0 && !matrix && !stats) {
+			for (int f = 0; f < COUNT(factor_sets); f++) {
+				struct adjust_plan *plan = adjust_plan_create(factor_sets[f].r, factor_sets[f].g,
+					factor_sets[f].b, channels, plan_bits);
+				char name[64];
+
+				snprintf(name, sizeof(name), "planned: %s", adjust_plan_kernel(plan));
+				bench(plan, 0, name, sizes[s].name, factor_sets[f].name, image, x, y);
+				adjust_plan_destroy(plan);
+			}
+		}
+
+		// ==================== The statistics pass, and the adjust pass it comes before
+		// (the adjust pass last, as it changes the image)
+		if (stats) {
+			struct adjust_plan *plan = adjust_plan_create(0.8, 1.2, 1.5, channels, plan_bits);
+			char name[64];
+
+			bench(NULL, 1, "stats: every row, random", sizes[s].name, "-", image, x, y);
+			bench(NULL, 0, "stats: sampled, random", sizes[s].name, "-", image, x, y);
+			memset(image, 0x80, bytes);
+			bench(NULL, 1, "stats: every row, constant", sizes[s].name, "-", image, x, y);
+			bench(NULL, 0, "stats: sampled, constant", sizes[s].name, "-", image, x, y);
+			fill_random(image, bytes);
+
+			snprintf(name, sizeof(name), "planned: %s", adjust_plan_kernel(plan));
+			bench(plan, 0, name, sizes[s].name, "0.8/1.2/1.5", image, x, y);
+			adjust_plan_destroy(plan);
+		}
+		if (hugepages < 0) {
+			free(image);
+		} else {
+			adjust_free(image);
+		}
+	}
+	return 0;
+}
@@ -0,0 +1,132 @@
+/*
+
+  adjust-large :: check every implementation on an image larger than 2GB
+
+  A 30000 x 30000 RGB image is 2.7GB - more bytes than an int can count,
+  so any 32-bit size or counter along the way (in the plan, the band
+  split, or a kernel's loop or inline assembler) shows up as pixels past
+  the 2GB mark left unchanged or written in the wrong place.
+
+  The synthetic image repeats a pattern with a period of 256 pixels
+  (each channel of pixel i is (i + 85c) mod 256, so the three channels
+  differ), which is also adjusted on its own with the same plan as a
+  reference. Every pixel of the large image must then match the
+  reference pixel at the same position in the pattern. The image is
+  allocated with adjust_alloc(): transparent huge pages, or with
+  --hugepages=2m or 1g, pages from the hugetlbfs pool.
+
+  One line of CSV per implementation is written to stdout: the time
+  taken and the number of mismatched bytes, which must be 0. The exit
+  status is 1 if any implementation had a mismatch.
+
+  (C)2022 Seneca College of Applied Arts and Technology.
+  Written by Chris Tyler. Licensed under the terms of the GPL verion 2.
+
+*/
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "adjust_channels.h"
+
+#define PERIOD		256		// pixels in the repeating pattern
+
+static uint64_t now_ns(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static void fill(unsigned char *image, size_t pixels) {
+	for (size_t i = 0; i < pixels; i++) {
+		for (int c = 0; c < 3; c++) {
+			image[i * 3 + c] = (i + 85 * c) % 256;
+		}
+	}
+}
+
+static void usage(char *name) {
+	dprintf(2, "\nUsage: %s [--impl=N|name|all] [--threads=N] [--size=WxH] [--hugepages=2m|1g]\n", name);
+	dprintf(2, "where --size defaults to 30000x30000 (2.7GB)\n");
+}
+
+int main(int argc, char *argv[]) {
+
+	// ==================== Process options
+	const char *impl = "all";
+	int threads = 0, x = 30000, y = 30000, flags = 0;
+
+	for (int i = 1; i < argc; i++) {
+		if (strncmp(argv[i], "--impl=", 7) == 0) {
+			impl = argv[i] + 7;
+		} else if (strncmp(argv[i], "--threads=", 10) == 0) {
+			threads = atoi(argv[i] + 10);
+		} else if (strncmp(argv[i], "--size=", 7) == 0) {
+			if (sscanf(argv[i] + 7, "%dx%d", &x, &y) != 2) {
+				x = 0;
+			}
+		} else if (strcmp(argv[i], "--hugepages=2m") == 0) {
+			flags = ADJUST_ALLOC_HUGE_2M;
+		} else if (strcmp(argv[i], "--hugepages=1g") == 0) {
+			flags = ADJUST_ALLOC_HUGE_1G;
+		} else {
+			usage(argv[0]);
+			return 1;
+		}
+	}
+	if (x <= 0 || y <= 0) {
+		usage(argv[0]);
+		return 1;
+	}
+	threads = adjust_set_threads(threads);
+
+	size_t pixels = (size_t)x * y;
+	unsigned char *image = adjust_alloc(pixels * 3, flags);
+	unsigned char reference[PERIOD * 3];
+	int failed = 0;
+
+	if (image == NULL) {
+		dprintf(2, "Could not allocate %zu bytes for a %dx%d image.\n", pixels * 3, x, y);
+		return 2;
+	}
+
+	printf("impl,impl_name,width,height,bytes,threads,seconds,mismatches\n");
+
+	for (int m = 0; m < adjust_implementation_count; m++) {
+		const struct adjust_implementation *impl_m = &adjust_implementations[m];
+		char number[16];
+
+		snprintf(number, sizeof(number), "%d", impl_m->number);
+		if (!impl_m->supported() || (strcmp(impl, "all") != 0 &&
+		    strcmp(impl, impl_m->name) != 0 && strcmp(impl, number) != 0)) {
+			continue;
+		}
+
+		struct adjust_plan *plan = adjust_plan_create(0.8, 1.2, 1.5, 3, ADJUST_PLAN_IMPL(impl_m->number));
+
+		fill(reference, PERIOD);
+		adjust_plan_execute(plan, reference, PERIOD, 1);
+
+		fill(image, pixels);
+		uint64_t start = now_ns();
+		adjust_plan_execute(plan, image, x, y);
+		uint64_t elapsed = now_ns() - start;
+
+		size_t mismatches = 0;
+		for (size_t i = 0; i < pixels * 3; i++) {
+			mismatches += image[i] != reference[i % (PERIOD * 3)];
+		}
+
+		printf("%d,\"%s\",%d,%d,%zu,%d,%.3f,%zu\n", impl_m->number, impl_m->name, x, y, pixels * 3,
+			threads, elapsed / 1e9, mismatches);
+		fflush(stdout);
+		failed |= mismatches != 0;
+		adjust_plan_destroy(plan);
+	}
+
+	adjust_free(image);
+	return failed;
+}
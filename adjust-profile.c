@@ -0,0 +1,92 @@
+/*
+
+  adjust-profile :: run one adjust_channels() implementation a fixed number of times
+  
+  This is the workload for instruction-count profiling under qemu (see
+  scripts/vl_profile and profile/insn-mem.c). It does nothing but build
+  a synthetic image and call adjust_channels() on it --calls times, so
+  running it once with --calls=0 and once with --calls=N and subtracting
+  the counts gives the instructions and memory traffic of N calls alone.
+  (The plan is created in both runs, so its setup is not counted.)
+  
+  (C)2022 Seneca College of Applied Arts and Technology.
+  Written by Chris Tyler. Licensed under the terms of the GPL verion 2.
+  
+*/
+
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "adjust_channels.h"
+
+static void usage(char *name) {
+	dprintf(2, "\nUsage: %s --impl=N|name [--pixels=N] [--calls=N] [--factors=r,g,b]\n", name);
+}
+
+int main(int argc, char *argv[]) {
+	const char *impl = NULL;
+	size_t pixels = 65536;
+	int calls = 1;
+	float r = 0.8, g = 1.2, b = 1.5;
+
+	for (int i = 1; i < argc; i++) {
+		if (strncmp(argv[i], "--impl=", 7) == 0) {
+			impl = argv[i] + 7;
+		} else if (strncmp(argv[i], "--pixels=", 9) == 0) {
+			pixels = strtoull(argv[i] + 9, NULL, 10);
+		} else if (strncmp(argv[i], "--calls=", 8) == 0) {
+			calls = atoi(argv[i] + 8);
+		} else if (strncmp(argv[i], "--factors=", 10) == 0) {
+			if (sscanf(argv[i] + 10, "%f,%f,%f", &r, &g, &b) != 3) {
+				usage(argv[0]);
+				return 1;
+			}
+		} else {
+			usage(argv[0]);
+			return 1;
+		}
+	}
+	// (the image is a single row, and adjust_plan_execute() takes the width as an int)
+	if (impl == NULL || pixels < 1 || pixels > INT_MAX || calls < 0) {
+		usage(argv[0]);
+		return 1;
+	}
+	// (with ADJUST_PLAN_NO_FASTPATH, so a fast path such as #7 can't stand in for the
+	// implementation being profiled)
+	struct adjust_plan *plan;
+	if (adjust_select_implementation(impl) != 0 ||
+	    (plan = adjust_plan_create(r, g, b, 3, ADJUST_PLAN_NO_FASTPATH)) == NULL) {
+		dprintf(2, "Implementation '%s' is unknown or not supported on this CPU.\n", impl);
+		return 1;
+	}
+	if (adjust_plan_implementation(plan) != adjust_current_implementation()) {
+		dprintf(2, "Implementation '%s' was replaced by #%d (%s) - not profiling it.\n", impl,
+			adjust_plan_implementation(plan)->number, adjust_plan_kernel(plan));
+		return 1;
+	}
+	dprintf(2, "Profiling implementation #%d (%s)\n", adjust_plan_implementation(plan)->number,
+		adjust_plan_kernel(plan));
+
+	// Synthetic image (same LCG as adjust-bench)
+	unsigned char *image = malloc(pixels * 3);
+	uint32_t seed = 12345;
+	if (image == NULL) {
+		dprintf(2, "Could not allocate %zu bytes for the image.\n", pixels * 3);
+		return 2;
+	}
+	for (size_t i = 0; i < pixels * 3; i++) {
+		seed = seed * 1103515245 + 12345;
+		image[i] = seed >> 24;
+	}
+
+	for (int c = 0; c < calls; c++) {
+		adjust_plan_execute(plan, image, pixels, 1);
+	}
+
+	adjust_plan_destroy(plan);
+	free(image);
+	return 0;
+}
@@ -3,8 +3,198 @@
 #ifndef ADJUST_CHANNELS_H
 #define ADJUST_CHANNELS_H
 
+#include <stddef.h>
+#include <stdint.h>
+
+// Adjust the channels using the implementation selected at runtime
+// (a thin wrapper around the adjust_plan functions below)
 void adjust_channels(unsigned char *image, int x_size, int y_size, 
 	float red_factor, float green_factor, float blue_factor);
+
+// Adjust the width x height region at (x0, y0) of an 8-bit RGB image at 'src', storing the
+// result in the same region of the image at 'dst' - which may be 'src' itself. Strides are
+// the bytes from the start of one row to the next, so crops and padded rows need no copy.
+void adjust_channels_ex(const unsigned char *src, int src_stride, unsigned char *dst, int dst_stride,
+	int x0, int y0, int width, int height, float red_factor, float green_factor, float blue_factor);
+
+// ==================== Image buffers (see adjust_alloc.c)
+
+// Flags for adjust_alloc()
+#define ADJUST_ALLOC_HUGE_2M	1		// 2MB pages from the hugetlbfs pool, if there are any
+#define ADJUST_ALLOC_HUGE_1G	2		// 1GB pages, likewise
+
+// Allocate an image buffer backed by huge pages: from the hugetlbfs pool if asked for (and
+// available), otherwise transparent huge pages. Returns NULL if there isn't enough memory.
+void *adjust_alloc(size_t bytes, int flags);
+void adjust_free(void *buffer);
+
+// ==================== Plans (see adjust_plan.c)
+//
+// A plan holds everything that depends only on the factors - fixed-point
+// values, factor tables, lookup tables, and the chosen implementation - so
+// that it is computed once and reused for any number of images. A plan is
+// not modified by adjust_plan_execute(), so one plan may be used from many
+// threads at once. The thread pool (see adjust_set_threads()) runs one image
+// at a time; an image executed while it is busy is processed on the calling
+// thread alone. adjust_set_threads() itself must not run alongside any of them.
+
+struct adjust_plan;
+
+// Flags for adjust_plan_create()
+#define ADJUST_PLAN_IMPL(n)	((n) & 0xff)	// use implementation #n rather than the current selection
+#define ADJUST_PLAN_IMPL_MASK	0xff
+#define ADJUST_PLAN_NO_FASTPATH	0x100		// always use the selected implementation (see adjust_plan.c)
+#define ADJUST_PLAN_16BIT	0x200		// 16 bits per channel: the image is an array of uint16_t
+
+// 'channels' is the number of channels per pixel: 1 (grey), 2 (grey + alpha), 3 (RGB) or 4 (RGBA).
+// Alpha is left unchanged, and grey is scaled by the factors' effect on luma. The factors
+// are clamped to 0.0-2.0. Returns NULL if the channel count or implementation is not supported.
+struct adjust_plan *adjust_plan_create(float red_factor, float green_factor, float blue_factor,
+	int channels, int flags);
+void adjust_plan_execute(const struct adjust_plan *plan, void *image, int x_size, int y_size);
+
+// Flags for adjust_plan_execute_ex()
+#define ADJUST_EX_STREAM	1		// always write the output with non-temporal stores
+#define ADJUST_EX_NO_STREAM	2		// never (by default: out of place, and larger than the LLC)
+
+// Execute a plan on a region of an image, out of place or in place and with any row
+// strides, as for adjust_channels_ex(); adjust_plan_execute() is the packed, in-place case
+void adjust_plan_execute_ex(const struct adjust_plan *plan, const void *src, int src_stride,
+	void *dst, int dst_stride, int x0, int y0, int width, int height, int flags);
+void adjust_plan_destroy(struct adjust_plan *plan);
+
+// The implementation a plan uses, and a short description of its kernel (e.g. "sve2-fast, uniform")
+const struct adjust_implementation *adjust_plan_implementation(const struct adjust_plan *plan);
+const char *adjust_plan_kernel(const struct adjust_plan *plan);
+
+// ==================== Operation lists (see adjust_ops.c)
+
+// A list of colour operations on 8-bit RGB images, compiled into a plan that applies all
+// of them in a single pass over the image. Values are in the units of the 0-255 samples.
+struct adjust_ops;
+
+struct adjust_ops *adjust_ops_create(void);
+void adjust_ops_destroy(struct adjust_ops *ops);
+
+// Append an operation to the list. Each returns 0, or -1 if out of memory or the
+// arguments are out of range.
+int adjust_ops_scale(struct adjust_ops *ops, float red, float green, float blue);	// multiply
+int adjust_ops_offset(struct adjust_ops *ops, float red, float green, float blue);	// add
+int adjust_ops_matrix(struct adjust_ops *ops, const float matrix[9]);	// out[i] = sum of matrix[3i + j] * in[j]
+int adjust_ops_curve(struct adjust_ops *ops, const unsigned char curve[3][256]);	// per-channel table
+int adjust_ops_gamma(struct adjust_ops *ops, float gamma);		// 255 * (in / 255) ^ (1 / gamma)
+int adjust_ops_contrast(struct adjust_ops *ops, float contrast);	// scale around mid-grey (127.5)
+int adjust_ops_clamp(struct adjust_ops *ops, float low, float high);
+
+// Colour matrices, with the offsets that go with them: full-range BT.601 RGB to YCbCr, as in
+// JPEG (Y, Cb, Cr in place of R, G, B - Cb and Cr centred on 128), and back; and saturation,
+// mixing each channel with BT.601 luma (0 gives grey, 1 changes nothing, above 1 is stronger)
+int adjust_ops_rgb_to_ycbcr(struct adjust_ops *ops);
+int adjust_ops_ycbcr_to_rgb(struct adjust_ops *ops);
+int adjust_ops_saturation(struct adjust_ops *ops, float saturation);
+
+// Append the operations described by 'text', e.g. "offset=10,gamma=2.2,clamp=16:235" - each
+// operation's values are separated by ':', and one value for scale or offset applies to all
+// three channels ("ycbcr" and "rgb" have none). Returns 0, or -1 if the text isn't understood.
+int adjust_ops_parse(struct adjust_ops *ops, const char *text);
+
+// Compile the list into a plan for 8-bit RGB images, run with adjust_plan_execute() or
+// adjust_plan_execute_ex(); 'flags' as for adjust_plan_create(). Returns NULL if the list
+// can't be applied in one pass (a curve or clamp between two matrices) or the flags aren't
+// supported (ADJUST_PLAN_16BIT).
+struct adjust_plan *adjust_ops_plan(const struct adjust_ops *ops, int flags);
+
+// A plan for one colour matrix plus bias, out[i] = sum of matrix[3i + j] * in[j] + bias[i]
+// ('bias' may be NULL) - e.g. white balance (a diagonal matrix) or channel mixing. Shorthand
+// for an operation list of a matrix and an offset; returns NULL as adjust_ops_plan() does, or
+// if a coefficient is 8 or more in magnitude.
+struct adjust_plan *adjust_plan_create_matrix(const float matrix[9], const float bias[3], int flags);
+
+// ==================== Image statistics and automatic white balance (see adjust_stats.c)
+
+struct adjust_stats {
+	int		colours;		// channels counted: 1 (grey) or 3 (red, green, blue)
+	uint64_t	samples;		// pixels counted
+	uint64_t	histogram[3][256];	// per channel (for 16-bit images, of the high byte)
+	double		mean[3];		// per channel, 0.0-255.0
+};
+
+// Flags for adjust_image_stats(), besides ADJUST_PLAN_16BIT
+#define ADJUST_STATS_BIG_ENDIAN	0x400		// 16-bit values are stored high byte first (as in Netpbm files)
+
+// Count the colour channels (not alpha) of every 'step'th row of an image laid out as for
+// adjust_plan_execute(), across the adjust_set_threads() threads. A 'step' of 0 picks one
+// that counts about ADJUST_STATS_SAMPLES pixels. Returns 0, or -1 if the arguments aren't
+// supported or out of memory.
+#define ADJUST_STATS_SAMPLES	(1024 * 1024)
+int adjust_image_stats(const void *image, int x_size, int y_size, int channels, int step, int flags,
+	struct adjust_stats *stats);
+
+// The lowest value that at least 'fraction' (0.0-1.0) of a channel's samples are at or below
+int adjust_stats_percentile(const struct adjust_stats *stats, int channel, double fraction);
+
+// Methods for adjust_auto_factors()
+#define ADJUST_AUTO_GRAY_WORLD	0		// make the channel means equal (keeping their average)
+#define ADJUST_AUTO_STRETCH	1		// scale each channel so its brightest samples become 255
+
+// Red, green and blue factors (0.0-2.0) for automatic white balance of an image with these
+// statistics. 'clip' is the fraction of each channel's samples that ADJUST_AUTO_STRETCH lets
+// saturate (e.g. 0.005), so that a few specular highlights don't set the white point.
+void adjust_auto_factors(const struct adjust_stats *stats, int method, double clip, float factors[3]);
+
+// ==================== Implementations (see adjust_channels.c and adjust_dispatch.c)
+
+// Adjust 'pixels' packed pixels from 'src' into 'dst' (which may be the same as 'src')
+typedef void (*adjust_kernel_fn)(const struct adjust_plan *plan, const unsigned char *src, unsigned char *dst,
+	size_t pixels);
+
+// Implementation flags: what an implementation needs precomputed in the plan, and how it rounds
+#define ADJUST_NEEDS_FACTOR_TABLE	1	// interleaved factor table (#3)
+#define ADJUST_NEEDS_LUT		2	// per-channel lookup tables (#6)
+#define ADJUST_FIXED_POINT		4	// 6-bit fixed-point factors (#2), rather than float math (#1)
+#define ADJUST_ANY_CHANNELS		8	// handles 1-4 channels, not just RGB
+#define ADJUST_ROUNDED			16	// rounds to nearest, rather than truncating (#9)
+
+// Description of one implementation, and the table of all of them
+struct adjust_implementation {
+	int			number;		// implementation number, as in adjust_channels.c
+	const char		*name;		// short name accepted by --impl=
+	const char		*description;
+	int			(*supported)(void);	// nonzero if this CPU can run it
+	int			(*vector_bytes)(void);	// vector length used by this implementation
+	int			flags;		// ADJUST_* flags above
+	adjust_kernel_fn	kernel;
+	adjust_kernel_fn	kernel16;	// kernel for 16 bits per channel, or NULL if there isn't one
+	adjust_kernel_fn	fused;		// kernel for operation lists, or NULL if there isn't one
+};
+
+extern const struct adjust_implementation adjust_implementations[];
+extern const int adjust_implementation_count;
+
+// Select an implementation by number or name ("auto" picks the fastest supported one).
+// Returns 0 on success, -1 if the name is unknown or the CPU cannot run it.
+int adjust_select_implementation(const char *name);
+
+// The implementation that adjust_channels() and new plans will use
+const struct adjust_implementation *adjust_current_implementation(void);
+
+// Implementation #n, or NULL if there is no such implementation
+const struct adjust_implementation *adjust_find_implementation(int number);
+
+// Implementation #n, or NULL if it isn't built for this architecture or the CPU can't run it
+const struct adjust_implementation *adjust_find_supported(int number);
+
+// Number of threads a plan splits the image across (0 = one per online CPU).
+// Returns the number of threads actually in use.
+int adjust_set_threads(int threads);
+
+// Run task(arg, 0) .. task(arg, count - 1) on those threads (or on the calling thread, if
+// there is only one), returning when all are done - for other work on the image, such as
+// encoding it. If the threads are busy with another caller's tasks, runs them on the
+// calling thread.
+void adjust_run_tasks(void (*task)(void *arg, int index), void *arg, int count);
+
+// SVE vector length in bytes (implemented in the SVE2 ACLE object; only call if SVE is present)
+int adjust_sve_vector_bytes(void);
 	
 #endif
-
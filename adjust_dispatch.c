@@ -0,0 +1,184 @@
+/*
+
+        adjust_dispatch :: choose an adjust_channels() implementation at runtime
+        
+        All of the implementations in adjust_channels.c are linked into the
+        binary. This file checks which of them the CPU can run, using the
+        hardware capability bits that the kernel passes in the auxiliary
+        vector (getauxval(AT_HWCAP) / getauxval(AT_HWCAP2)), and routes
+        adjust_channels() to the fastest supported one - unless a specific
+        implementation has been requested with adjust_select_implementation().
+        
+        adjust_channels() can also split the image into bands of rows and
+        run the selected implementation on each band from a pool of worker
+        threads (see adjust_set_threads()). Each band starts on a multiple
+        of the vector length (in pixels) and of the cache line size, so that
+        every band but the last is processed in whole vectors and no two
+        threads write to the same cache line.
+        
+        On x86-64, the implementations are #1 and the AVX2 and AVX-512BW
+        ports (#10, #11), and support is checked with CPUID instead.
+
+        This file must be compiled for the baseline architecture (armv8-a or
+        x86-64), since it runs before we know whether SVE2 (or AVX2) is
+        available.
+        
+        Copyright (C)2022 Seneca College of Applied Arts and Technology
+        Written by Chris Tyler
+        Distributed under the terms of the GNU GPL v2
+        
+*/
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "adjust_channels.h"
+#include "adjust_plan.h"
+
+static int always(void) {
+	return 1;
+}
+
+static int neon_vector_bytes(void) {
+	return 16;
+}
+
+#if defined(__aarch64__)
+
+#include <sys/auxv.h>
+
+// Capability bits from <asm/hwcap.h>, defined here in case the headers are older
+#ifndef HWCAP_ASIMD
+#define HWCAP_ASIMD	(1 << 1)
+#endif
+#ifndef HWCAP2_SVE2
+#define HWCAP2_SVE2	(1 << 1)
+#endif
+
+static int have_asimd(void) {
+	return (getauxval(AT_HWCAP) & HWCAP_ASIMD) != 0;
+}
+
+static int have_sve2(void) {
+	return (getauxval(AT_HWCAP2) & HWCAP2_SVE2) != 0;
+}
+
+#elif defined(__x86_64__)
+
+// CPUID feature bits, as read by the compiler's runtime (which also checks with XGETBV
+// that the OS saves the AVX and AVX-512 registers)
+static int have_avx2(void) {
+	return __builtin_cpu_supports("avx2");
+}
+
+static int have_avx512bw(void) {
+	return __builtin_cpu_supports("avx512bw");
+}
+
+static int avx2_vector_bytes(void) {
+	return 32;
+}
+
+static int avx512_vector_bytes(void) {
+	return 64;
+}
+
+#endif
+
+const struct adjust_implementation adjust_implementations[] = {
+	{ 1, "naive",            "Naive (autovectorizable)",                  always,     neon_vector_bytes,       ADJUST_ANY_CHANNELS,
+		adjust_channels_naive, adjust_channels_naive_u16, adjust_ops_naive },
+#if defined(__aarch64__)
+	{ 2, "sve2-ld3b",        "Inline assembler for SVE2, structure load", have_sve2,  adjust_sve_vector_bytes, ADJUST_FIXED_POINT,
+		adjust_channels_ld3b },
+	{ 3, "sve2-interleaved", "Inline assembler for SVE2, interleaved",    have_sve2,  adjust_sve_vector_bytes, ADJUST_NEEDS_FACTOR_TABLE | ADJUST_FIXED_POINT,
+		adjust_channels_interleaved },
+	{ 4, "sve2-acle",        "ACLE (intrinsics for SVE2)",                have_sve2,  adjust_sve_vector_bytes, ADJUST_FIXED_POINT | ADJUST_ANY_CHANNELS,
+		adjust_channels_acle, adjust_channels_acle_u16 },
+	{ 5, "neon",             "Advanced SIMD (NEON) intrinsics",           have_asimd, neon_vector_bytes,       ADJUST_FIXED_POINT | ADJUST_ANY_CHANNELS,
+		adjust_channels_neon, adjust_channels_neon_u16 },
+	{ 6, "sve2-lut",         "ACLE (intrinsics for SVE2), lookup tables", have_sve2,  adjust_sve_vector_bytes, ADJUST_NEEDS_LUT,
+		adjust_channels_lut, NULL, adjust_ops_sve2 },
+	{ 7, "sve2-fast",        "ACLE for SVE2, factor-specialized",         have_sve2,  adjust_sve_vector_bytes, ADJUST_FIXED_POINT,
+		adjust_channels_sve2_fast },
+	{ 8, "neon-fast",        "Advanced SIMD (NEON), factor-specialized",  have_asimd, neon_vector_bytes,       ADJUST_FIXED_POINT,
+		adjust_channels_neon_fast },
+	{ 9, "sve2-precise",     "ACLE for SVE2, rounded 14-bit fixed point", have_sve2,  adjust_sve_vector_bytes, ADJUST_ROUNDED,
+		adjust_channels_sve2_precise },
+#elif defined(__x86_64__)
+	{ 10, "avx2",            "AVX2 intrinsics (x86-64)",                  have_avx2,  avx2_vector_bytes,       ADJUST_FIXED_POINT | ADJUST_ANY_CHANNELS,
+		adjust_channels_avx2 },
+	{ 11, "avx512bw",        "AVX-512BW intrinsics (x86-64)",             have_avx512bw, avx512_vector_bytes,  ADJUST_FIXED_POINT | ADJUST_ANY_CHANNELS,
+		adjust_channels_avx512 },
+#endif
+};
+
+const int adjust_implementation_count = sizeof(adjust_implementations) / sizeof(adjust_implementations[0]);
+
+// Order of preference when selecting automatically (fastest first)
+#if defined(__x86_64__)
+static const int preference[] = { 11, 10, 1 };
+#else
+static const int preference[] = { 2, 4, 5, 1 };
+#endif
+
+static const struct adjust_implementation *current = NULL;
+
+const struct adjust_implementation *adjust_find_implementation(int number) {
+	for (int i = 0; i < adjust_implementation_count; i++) {
+		if (adjust_implementations[i].number == number) {
+			return &adjust_implementations[i];
+		}
+	}
+	return NULL;
+}
+
+const struct adjust_implementation *adjust_find_supported(int number) {
+	const struct adjust_implementation *impl = adjust_find_implementation(number);
+
+	return impl != NULL && impl->supported() ? impl : NULL;
+}
+
+static const struct adjust_implementation *find(const char *name) {
+	char *end;
+	long number = strtol(name, &end, 10);
+
+	if (end != name && *end == '\0') {
+		return adjust_find_implementation(number);
+	}
+	for (int i = 0; i < adjust_implementation_count; i++) {
+		if (strcmp(adjust_implementations[i].name, name) == 0) {
+			return &adjust_implementations[i];
+		}
+	}
+	return NULL;
+}
+
+int adjust_select_implementation(const char *name) {
+	const struct adjust_implementation *impl;
+
+	if (strcmp(name, "auto") == 0) {
+		for (int i = 0; i < sizeof(preference) / sizeof(preference[0]); i++) {
+			impl = adjust_find_supported(preference[i]);
+			if (impl != NULL) {
+				current = impl;
+				return 0;
+			}
+		}
+		return -1;
+	}
+
+	impl = find(name);
+	if (impl == NULL || !impl->supported()) {
+		return -1;
+	}
+	current = impl;
+	return 0;
+}
+
+const struct adjust_implementation *adjust_current_implementation(void) {
+	if (current == NULL) {
+		adjust_select_implementation("auto");
+	}
+	return current;
+}
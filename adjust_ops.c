@@ -0,0 +1,430 @@
+/*
+
+        adjust_ops :: several colour operations, fused into one pass over the image
+
+        Scaling the channels is rarely the only thing done to an image: a
+        brightness offset, gamma, contrast, channel mixing and a final clamp
+        usually follow, and as separate functions each of them would be
+        another full pass over the image - read and written from memory
+        again for every operation. An operation list is instead compiled
+        into a plan that applies all of them while each vector of pixels is
+        in registers, between one load (LD3B) and one store (ST3B), so the
+        image is read and written exactly once however long the list is.
+
+        Every operation works either on each channel separately (scale,
+        offset, curve, clamp, and gamma and contrast, which are made from
+        them) or mixes the channels (matrix). Any chain of per-channel
+        operations on an 8-bit value is just a function of that value, so
+        it becomes a 256-entry lookup table per channel; and any chain of
+        scales, offsets and matrices is one 3x3 matrix plus a bias. So a
+        list compiles into at most three stages:
+
+                pre-LUT         the per-channel operations before the first
+                                matrix, up to the last curve or clamp
+                matrix          everything from there to the first curve or
+                                clamp after the last matrix, folded into one
+                                matrix and bias (12-bit fixed point)
+                post-LUT        the rest
+
+        (a curve or clamp between two matrices can't be folded, so such a
+        list is refused). A matrix that doesn't mix the channels is folded
+        into the tables as well, leaving a single table lookup.
+
+        The operations are defined on real values, and the result is rounded
+        to the nearest integer and clamped to 0-255 at the end. The value
+        passed to a curve, and the values between the stages, are rounded
+        and clamped the same way, so a list with lookup tables on both sides
+        of a matrix is rounded up to three times.
+
+        The kernels for the stages are in adjust_channels.c: #6 (SVE2, with
+        a separate loop for each common combination of stages) and #1 (the
+        reference, in C, with the same integer math). Other implementations
+        use #6 if the CPU has SVE2, and #1 otherwise.
+
+        Copyright (C)2022 Seneca College of Applied Arts and Technology
+        Written by Chris Tyler
+        Distributed under the terms of the GNU GPL v2
+
+*/
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/param.h>
+
+#include "adjust_channels.h"
+#include "adjust_plan.h"
+
+enum { SCALE, OFFSET, MATRIX, CURVE, CLAMP };
+
+struct op {
+	int		type;
+	float		value[9];	// per channel (scale, offset), the matrix, or low and high (clamp)
+	uint8_t		curve[3][256];
+};
+
+struct adjust_ops {
+	struct op	*op;
+	int		count;
+};
+
+// ==================== Building a list
+
+struct adjust_ops *adjust_ops_create(void) {
+	return calloc(1, sizeof(struct adjust_ops));
+}
+
+void adjust_ops_destroy(struct adjust_ops *ops) {
+	if (ops != NULL) {
+		free(ops->op);
+		free(ops);
+	}
+}
+
+// Add an operation of 'type' to the list, and return it to be filled in
+static struct op *append(struct adjust_ops *ops, int type) {
+	struct op *more = realloc(ops->op, sizeof(*more) * (ops->count + 1));
+
+	if (more == NULL) {
+		return NULL;
+	}
+	ops->op = more;
+	memset(&more[ops->count], 0, sizeof(*more));
+	more[ops->count].type = type;
+	return &more[ops->count++];
+}
+
+static int append_values(struct adjust_ops *ops, int type, const float *value, int count) {
+	struct op *op = append(ops, type);
+
+	if (op == NULL) {
+		return -1;
+	}
+	memcpy(op->value, value, sizeof(float) * count);
+	return 0;
+}
+
+int adjust_ops_scale(struct adjust_ops *ops, float red, float green, float blue) {
+	return append_values(ops, SCALE, (float []){ red, green, blue }, 3);
+}
+
+int adjust_ops_offset(struct adjust_ops *ops, float red, float green, float blue) {
+	return append_values(ops, OFFSET, (float []){ red, green, blue }, 3);
+}
+
+int adjust_ops_matrix(struct adjust_ops *ops, const float matrix[9]) {
+	return append_values(ops, MATRIX, matrix, 9);
+}
+
+int adjust_ops_clamp(struct adjust_ops *ops, float low, float high) {
+	return low > high ? -1 : append_values(ops, CLAMP, (float []){ low, high }, 2);
+}
+
+int adjust_ops_curve(struct adjust_ops *ops, const unsigned char curve[3][256]) {
+	struct op *op = append(ops, CURVE);
+
+	if (op == NULL) {
+		return -1;
+	}
+	memcpy(op->curve, curve, sizeof(op->curve));
+	return 0;
+}
+
+int adjust_ops_gamma(struct adjust_ops *ops, float gamma) {
+	unsigned char curve[3][256];
+
+	if (!(gamma > 0)) {
+		return -1;
+	}
+	for (int v = 0; v < 256; v++) {
+		curve[0][v] = curve[1][v] = curve[2][v] = lrintf(255 * powf(v / 255.0f, 1 / gamma));
+	}
+	return adjust_ops_curve(ops, curve);
+}
+
+int adjust_ops_contrast(struct adjust_ops *ops, float contrast) {
+	float offset = 127.5f * (1 - contrast);
+
+	return adjust_ops_scale(ops, contrast, contrast, contrast) == 0 &&
+		adjust_ops_offset(ops, offset, offset, offset) == 0 ? 0 : -1;
+}
+
+// Full-range BT.601 (as in JPEG/JFIF)
+#define KR	0.299f
+#define KG	0.587f
+#define KB	0.114f
+
+int adjust_ops_rgb_to_ycbcr(struct adjust_ops *ops) {
+	static const float matrix[9] = {
+		KR,				KG,				KB,
+		-0.5f * KR / (1 - KB),		-0.5f * KG / (1 - KB),		0.5f,
+		0.5f,				-0.5f * KG / (1 - KR),		-0.5f * KB / (1 - KR),
+	};
+
+	return adjust_ops_matrix(ops, matrix) == 0 && adjust_ops_offset(ops, 0, 128, 128) == 0 ? 0 : -1;
+}
+
+int adjust_ops_ycbcr_to_rgb(struct adjust_ops *ops) {
+	static const float matrix[9] = {
+		1,	0,				2 * (1 - KR),
+		1,	-2 * KB * (1 - KB) / KG,	-2 * KR * (1 - KR) / KG,
+		1,	2 * (1 - KB),			0,
+	};
+
+	return adjust_ops_offset(ops, 0, -128, -128) == 0 && adjust_ops_matrix(ops, matrix) == 0 ? 0 : -1;
+}
+
+int adjust_ops_saturation(struct adjust_ops *ops, float saturation) {
+	float s = saturation, l = 1 - saturation;
+
+	return adjust_ops_matrix(ops, (float []){
+		l * KR + s,	l * KG,		l * KB,
+		l * KR,		l * KG + s,	l * KB,
+		l * KR,		l * KG,		l * KB + s,
+	});
+}
+
+int adjust_ops_parse(struct adjust_ops *ops, const char *text) {
+	while (*text != '\0') {
+		char name[16];
+		float value[9];
+		int length, count = 0, result;
+
+		if (sscanf(text, "%15[a-z]%n", name, &length) != 1) {
+			return -1;
+		}
+		text += length;
+		if (*text == '=') {
+			do {
+				if (count == 9 || sscanf(text + 1, "%f%n", &value[count], &length) != 1) {
+					return -1;
+				}
+				count++;
+				text += 1 + length;
+			} while (*text == ':');
+		}
+		if (*text == ',') {
+			text++;
+		} else if (*text != '\0') {
+			return -1;
+		}
+
+		if ((strcmp(name, "scale") == 0 || strcmp(name, "offset") == 0) && (count == 1 || count == 3)) {
+			float *v = count == 1 ? (float []){ value[0], value[0], value[0] } : value;
+
+			result = name[0] == 's' ? adjust_ops_scale(ops, v[0], v[1], v[2]) :
+				adjust_ops_offset(ops, v[0], v[1], v[2]);
+		} else if (strcmp(name, "matrix") == 0 && count == 9) {
+			result = adjust_ops_matrix(ops, value);
+		} else if (strcmp(name, "gamma") == 0 && count == 1) {
+			result = adjust_ops_gamma(ops, value[0]);
+		} else if (strcmp(name, "contrast") == 0 && count == 1) {
+			result = adjust_ops_contrast(ops, value[0]);
+		} else if (strcmp(name, "clamp") == 0 && count == 2) {
+			result = adjust_ops_clamp(ops, value[0], value[1]);
+		} else if (strcmp(name, "saturation") == 0 && count == 1) {
+			result = adjust_ops_saturation(ops, value[0]);
+		} else if (strcmp(name, "ycbcr") == 0 && count == 0) {
+			result = adjust_ops_rgb_to_ycbcr(ops);
+		} else if (strcmp(name, "rgb") == 0 && count == 0) {
+			result = adjust_ops_ycbcr_to_rgb(ops);
+		} else {
+			return -1;
+		}
+		if (result != 0) {
+			return -1;
+		}
+	}
+	return 0;
+}
+
+// ==================== Compiling a list into a plan
+
+// Round and clamp to 0-255, as the kernels do when they store a value
+static int to_byte(float x) {
+	return x <= 0 ? 0 : x >= 255 ? 255 : (int)(x + 0.5f);
+}
+
+static int is_affine(const struct op *op) {
+	return op->type == SCALE || op->type == OFFSET || op->type == MATRIX;
+}
+
+// Apply 'count' per-channel operations to the value x of channel c
+static float per_channel(const struct op *op, int count, int c, float x) {
+	for (int i = 0; i < count; i++) {
+		switch (op[i].type) {
+		case SCALE:
+			x *= op[i].value[c];
+			break;
+		case OFFSET:
+			x += op[i].value[c];
+			break;
+		case CURVE:
+			x = op[i].curve[c][to_byte(x)];
+			break;
+		case CLAMP:
+			x = MIN(MAX(x, op[i].value[0]), op[i].value[1]);
+			break;
+		}
+	}
+	return x;
+}
+
+// Fold a scale, offset or matrix into the transform x -> a x + b, giving x -> op(a x + b)
+static void fold(const struct op *op, float a[9], float b[3]) {
+	float m[9] = { 1, 0, 0, 0, 1, 0, 0, 0, 1 }, add[3] = { 0, 0, 0 };
+	float a2[9], b2[3];
+
+	if (op->type == SCALE) {
+		m[0] = op->value[0];
+		m[4] = op->value[1];
+		m[8] = op->value[2];
+	} else if (op->type == OFFSET) {
+		memcpy(add, op->value, sizeof(add));
+	} else {
+		memcpy(m, op->value, sizeof(m));
+	}
+	for (int i = 0; i < 3; i++) {
+		for (int j = 0; j < 3; j++) {
+			a2[i * 3 + j] = m[i * 3] * a[j] + m[i * 3 + 1] * a[3 + j] + m[i * 3 + 2] * a[6 + j];
+		}
+		b2[i] = m[i * 3] * b[0] + m[i * 3 + 1] * b[1] + m[i * 3 + 2] * b[2] + add[i];
+	}
+	memcpy(a, a2, sizeof(a2));
+	memcpy(b, b2, sizeof(b2));
+}
+
+static int is_identity(const uint8_t (*lut)[512]) {
+	for (int c = 0; c < 3; c++) {
+		for (int v = 0; v < 256; v++) {
+			if (lut[c][v] != v) {
+				return 0;
+			}
+		}
+	}
+	return 1;
+}
+
+// Fill in a plan for an operation list - returns 0, or -1 if it can't be done in one pass
+static int ops_plan_init(struct adjust_plan *plan, const struct adjust_ops *ops, int flags) {
+	const struct adjust_implementation *impl = (flags & ADJUST_PLAN_IMPL_MASK) != 0 ?
+		adjust_find_implementation(flags & ADJUST_PLAN_IMPL_MASK) : adjust_current_implementation();
+	const struct op *op = ops->op;
+	int count = ops->count;
+
+	if (impl == NULL || !impl->supported() || (flags & ADJUST_PLAN_16BIT)) {
+		return -1;
+	}
+	if (impl->fused == NULL) {
+		impl = adjust_find_supported(6);
+		if (impl == NULL) {
+			impl = adjust_find_implementation(1);
+		}
+	}
+
+	// Operations [0, pre) go into the first tables, [pre, post) into the matrix, and
+	// [post, count) into the second tables. Without a matrix, everything is in the tables.
+	int first = -1, last = -1, pre = 0, post = count;
+
+	for (int i = 0; i < count; i++) {
+		if (op[i].type == MATRIX) {
+			first = first < 0 ? i : first;
+			last = i;
+		}
+	}
+	if (first < 0) {
+		pre = count;
+	}
+	for (int i = 0; i < first; i++) {
+		pre = is_affine(&op[i]) ? pre : i + 1;
+	}
+	for (int i = count - 1; i > last && first >= 0; i--) {
+		post = is_affine(&op[i]) ? post : i;
+	}
+
+	float a[9] = { 1, 0, 0, 0, 1, 0, 0, 0, 1 }, b[3] = { 0, 0, 0 };
+
+	for (int i = pre; i < post; i++) {
+		if (!is_affine(&op[i])) {
+			return -1;
+		}
+		fold(&op[i], a, b);
+	}
+
+	// Lookup tables, padded to 512 bytes for #6 (see adjust_plan_init()). A matrix that
+	// doesn't mix the channels is just another per-channel operation.
+	int mixes = a[1] != 0 || a[2] != 0 || a[3] != 0 || a[5] != 0 || a[6] != 0 || a[7] != 0;
+
+	memset(plan->lut, 0, sizeof(plan->lut));
+	memset(plan->post_lut, 0, sizeof(plan->post_lut));
+	for (int c = 0; c < 3; c++) {
+		for (int v = 0; v < 256; v++) {
+			plan->lut[c][v] = to_byte(per_channel(op, pre, c, v));
+			plan->post_lut[c][v] = to_byte(per_channel(op + post, count - post, c, v));
+		}
+		for (int v = 0; v < 256 && !mixes && first >= 0; v++) {
+			plan->lut[c][v] = plan->post_lut[c][to_byte(a[c * 4] * plan->lut[c][v] + b[c])];
+		}
+	}
+
+	plan->stages = ADJUST_STAGE_PRE_LUT;
+	if (mixes) {
+		plan->stages = (is_identity(plan->lut) ? 0 : ADJUST_STAGE_PRE_LUT) | ADJUST_STAGE_MATRIX |
+			(is_identity(plan->post_lut) ? 0 : ADJUST_STAGE_POST_LUT);
+
+		// The matrix in 12-bit fixed point: coefficients up to +/-8, and a bias that
+		// can't overflow the 32-bit sums
+		for (int i = 0; i < 9; i++) {
+			if (fabsf(a[i]) * (1 << ADJUST_MATRIX_SHIFT) >= 32767) {
+				return -1;
+			}
+			plan->matrix[i] = lrintf(a[i] * (1 << ADJUST_MATRIX_SHIFT));
+		}
+		for (int c = 0; c < 3; c++) {
+			plan->bias[c] = lrintf(MIN(MAX(b[c], -4096), 4096) * (1 << ADJUST_MATRIX_SHIFT));
+		}
+	}
+
+	// As for other plans, a plan that changes nothing does nothing - unless a particular
+	// implementation was asked for
+	plan->kernel = impl->fused;
+	if (plan->stages == ADJUST_STAGE_PRE_LUT && is_identity(plan->lut) &&
+	    (flags & (ADJUST_PLAN_NO_FASTPATH | ADJUST_PLAN_IMPL_MASK)) == 0) {
+		plan->kernel = NULL;
+	}
+	snprintf(plan->kernel_name, sizeof(plan->kernel_name), "%s, %s%s%s%s", impl->name,
+		plan->kernel == NULL ? "identity" : "ops",
+		plan->stages & ADJUST_STAGE_PRE_LUT ? " lut" : "",
+		plan->stages & ADJUST_STAGE_MATRIX ? " matrix" : "",
+		plan->stages & ADJUST_STAGE_POST_LUT ? " lut" : "");
+
+	plan->impl = impl;
+	plan->channels = 3;
+	plan->bytes_per_pixel = 3;
+	plan->vector_bytes = impl->vector_bytes();
+	plan->copy_nt = adjust_find_copy_nt();
+	return 0;
+}
+
+struct adjust_plan *adjust_ops_plan(const struct adjust_ops *ops, int flags) {
+	struct adjust_plan *plan = calloc(1, sizeof(*plan));
+
+	if (plan != NULL && ops_plan_init(plan, ops, flags) != 0) {
+		free(plan);
+		plan = NULL;
+	}
+	return plan;
+}
+
+struct adjust_plan *adjust_plan_create_matrix(const float matrix[9], const float bias[3], int flags) {
+	struct adjust_ops *ops = adjust_ops_create();
+	struct adjust_plan *plan = NULL;
+
+	if (ops != NULL && adjust_ops_matrix(ops, matrix) == 0 &&
+	    (bias == NULL || adjust_ops_offset(ops, bias[0], bias[1], bias[2]) == 0)) {
+		plan = adjust_ops_plan(ops, flags);
+	}
+	adjust_ops_destroy(ops);
+	return plan;
+}
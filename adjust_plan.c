@@ -0,0 +1,479 @@
+/*
+
+        adjust_plan :: precompute per-factor state once, then adjust many images
+        
+        Creating a plan chooses the implementation and computes everything
+        it needs that depends only on the factors:
+        
+                * the factors in fixed-point format (#2 - #5)
+                * the interleaved factor table, sized to the vector length (#3)
+                * the per-channel lookup tables (#6)
+                * the cheapest equivalent operation for each channel (#7, #8)
+                * for greyscale images, the equivalent grey factor
+        
+        Images with 1, 2 or 4 channels (grey, grey + alpha, RGBA) are
+        handled by the implementations flagged ADJUST_ANY_CHANNELS, and
+        images with 16 bits per channel by those with a kernel16; for
+        those, a plan for another implementation uses the nearest one that
+        can (#4 for SVE2, #5 for NEON, #11 or #10 on x86-64, otherwise #1).
+        
+        Unless a particular implementation is requested, creating a plan
+        also picks a fast path when the factors allow it: nothing at all
+        if every factor is 1.0, or the factor-specialized implementation
+        (shifts and saturating adds instead of multiplies, and a flat loop
+        without de-interleaving if all three factors are the same).
+        
+        Executing a plan just runs the implementation's loop - on one
+        thread, or split into bands of rows across a pool of worker threads
+        (see adjust_set_threads()). Each band starts on a multiple of the
+        vector length (in pixels) and of the cache line size, so that every
+        band but the last is processed in whole vectors and no two threads
+        write to the same cache line.
+        
+        A plan can also be executed on a region of an image, from a source
+        image into a separate destination, with any row strides
+        (adjust_plan_execute_ex()). The kernels work on packed runs of
+        pixels, so a region whose rows are packed is still one run, and
+        any other region is a run per row. An output too large for the last
+        level cache is written with non-temporal stores.
+        
+        adjust_channels() and adjust_channels_ex() are kept as wrappers
+        that build a plan on the stack for a single call.
+        
+        Copyright (C)2022 Seneca College of Applied Arts and Technology
+        Written by Chris Tyler
+        Distributed under the terms of the GNU GPL v2
+        
+*/
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/param.h>
+
+#include "adjust_channels.h"
+#include "adjust_plan.h"
+#include "adjust_threads.h"
+
+// ==================== Creating plans
+
+// Find the operation equivalent to multiplying by 'factor'. A factor of exactly 1.0,
+// 2.0, 0.0 or 2^-k gives the same results with a cheaper operation - in the float
+// math of #1 as well as the fixed-point math of #2 - except that below 2^-6 the
+// fixed-point factor truncates to zero, so those are left as multiplies.
+static int find_op(float factor, int *shift) {
+	if (factor == 1.0) {
+		return ADJUST_OP_IDENTITY;
+	}
+	if (factor == 2.0) {
+		return ADJUST_OP_DOUBLE;
+	}
+	if (factor == 0.0) {
+		*shift = 8;
+		return ADJUST_OP_SHIFT_RIGHT;
+	}
+	for (int k = 1; k <= 6; k++) {
+		if (factor == 1.0f / (1 << k)) {
+			*shift = k;
+			return ADJUST_OP_SHIFT_RIGHT;
+		}
+	}
+	return ADJUST_OP_MULTIPLY;
+}
+
+static void copy_cached(void *dst, const void *src, size_t bytes) {
+	memcpy(dst, src, bytes);
+}
+
+// Copy for streaming the output (see adjust_plan_execute_ex()): SVE (#4), NEON (#5) or AVX2 (#10)
+// if the CPU has them
+adjust_copy_fn adjust_find_copy_nt(void) {
+#if defined(__aarch64__)
+	if (adjust_find_supported(4) != NULL) {
+		return adjust_sve_copy_nt;
+	}
+	if (adjust_find_supported(5) != NULL) {
+		return adjust_neon_copy_nt;
+	}
+#elif defined(__x86_64__)
+	if (adjust_find_supported(10) != NULL) {
+		return adjust_avx2_copy_nt;
+	}
+#endif
+	return copy_cached;
+}
+
+int adjust_plan_init(struct adjust_plan *plan, float red_factor, float green_factor, float blue_factor,
+	int channels, int flags) {
+
+	const struct adjust_implementation *impl = (flags & ADJUST_PLAN_IMPL_MASK) != 0 ?
+		adjust_find_implementation(flags & ADJUST_PLAN_IMPL_MASK) : adjust_current_implementation();
+	float factor[3] = { red_factor, green_factor, blue_factor };
+
+	if (channels < 1 || channels > 4 || impl == NULL || !impl->supported()) {
+		return -1;
+	}
+
+	// The fixed-point factors only hold 0.0-2.0, so clamp to that range (NaN becomes 0.0)
+	for (int c = 0; c < 3; c++) {
+		factor[c] = !(factor[c] > 0) ? 0 : MIN(factor[c], 2);
+	}
+
+	// A grey pixel v would become (v*r, v*g, v*b); converting that back to grey with
+	// the weights stb_image uses for RGB to grey (77, 150 and 29 out of 256) gives
+	// v * (77r + 150g + 29b) / 256
+	if (channels <= 2) {
+		factor[0] = (77 * red_factor + 150 * green_factor + 29 * blue_factor) / 256;
+		factor[1] = factor[2] = factor[0];
+	}
+
+	// Only some implementations handle channel counts other than 3, or 16-bit channels;
+	// use the fastest of those
+	int wide = (flags & ADJUST_PLAN_16BIT) != 0;
+
+	if ((channels != 3 && !(impl->flags & ADJUST_ANY_CHANNELS)) || (wide && impl->kernel16 == NULL)) {
+		static const int fallback[] = { 4, 5, 11, 10, 1 };
+
+		for (int i = 0; i < sizeof(fallback) / sizeof(fallback[0]); i++) {
+			impl = adjust_find_supported(fallback[i]);
+			if (impl != NULL && (!wide || impl->kernel16 != NULL)) {
+				break;
+			}
+		}
+	}
+
+	// Factors as floats (#1), and in fixed-point format, 0-128 representing 0.0-2.0 (#2 - #5),
+	// or rounded to 14 bits, 0-32768 (#9, and 16-bit images)
+	for (int c = 0; c < 3; c++) {
+		plan->factor[c] = factor[c];
+		plan->fixed[c] = (int)(factor[c] * 64.0);
+		plan->fixed16[c] = (int)(factor[c] * 16384.0 + 0.5);
+	}
+
+	// Per-channel operations (#7, #8)
+	int special = 1;
+	for (int c = 0; c < 3; c++) {
+		plan->shift[c] = 0;
+		plan->op[c] = find_op(factor[c], &plan->shift[c]);
+		special = special && plan->op[c] != ADJUST_OP_MULTIPLY;
+	}
+	plan->uniform = plan->op[0] == plan->op[1] && plan->op[1] == plan->op[2] &&
+		plan->shift[0] == plan->shift[1] && plan->shift[1] == plan->shift[2] &&
+		plan->fixed[0] == plan->fixed[1] && plan->fixed[1] == plan->fixed[2];
+
+	// Fast paths - unless a particular implementation was asked for:
+	//	* if every factor is 1.0, there is nothing to do
+	//	* for 8-bit RGB, if every factor has a cheaper equivalent operation, or the implementation
+	//	  uses fixed-point math anyway, use the factor-specialized implementation for this
+	//	  CPU, which gives identical results (but not for a rounding implementation, which
+	//	  would give different results for 2^-k)
+	plan->kernel = wide ? impl->kernel16 : impl->kernel;
+	snprintf(plan->kernel_name, sizeof(plan->kernel_name), "%s%s", impl->name, wide ? ", 16-bit" : "");
+
+	if ((flags & (ADJUST_PLAN_NO_FASTPATH | ADJUST_PLAN_IMPL_MASK)) == 0) {
+		const struct adjust_implementation *fast = NULL;
+
+		fast = adjust_find_supported(7);
+		if (fast == NULL) {
+			fast = adjust_find_supported(8);
+		}
+
+		if (plan->uniform && plan->op[0] == ADJUST_OP_IDENTITY) {
+			plan->kernel = NULL;
+			snprintf(plan->kernel_name, sizeof(plan->kernel_name), "identity (nothing to do)");
+		} else if (fast != NULL && channels == 3 && !wide && !(impl->flags & ADJUST_ROUNDED) &&
+		    (special || (impl->flags & ADJUST_FIXED_POINT))) {
+			impl = fast;
+			plan->kernel = impl->kernel;
+			snprintf(plan->kernel_name, sizeof(plan->kernel_name), "%s%s", impl->name,
+				plan->uniform ? ", uniform" : "");
+		}
+	}
+
+	plan->impl = impl;
+	plan->channels = channels;
+	plan->bytes_per_pixel = wide ? channels * 2 : channels;
+	plan->vector_bytes = impl->vector_bytes();
+	plan->copy_nt = adjust_find_copy_nt();
+
+	// Interleaved factor table for #3: elements [0 .. elements3] hold the r/g/b factors,
+	// and the remaining elements (the incomplete pixel at the end of each vector) a dummy
+	// factor of 1.0, so that those bytes are left unchanged
+	if (impl->flags & ADJUST_NEEDS_FACTOR_TABLE) {
+		plan->elements3 = (plan->vector_bytes / 3) * 3;
+		for (int e = 0; e < plan->elements3; e++) {
+			plan->factor_table[e] = plan->fixed[e % 3];
+		}
+		for (int e = plan->elements3; e < plan->vector_bytes; e++) {
+			plan->factor_table[e] = 64;	// fixed-point value corresponding to 1.0
+		}
+	}
+
+	// Lookup tables for #6, using the same math as #1 and padded to 512 bytes so that
+	// the last vector-sized segment of a table can always be loaded in full
+	if (impl->flags & ADJUST_NEEDS_LUT) {
+		for (int c = 0; c < 3; c++) {
+			for (int v = 0; v < 256; v++) {
+				plan->lut[c][v] = MIN((float)v * factor[c], 255);
+			}
+			memset(plan->lut[c] + 256, 0, 256);
+		}
+	}
+	return 0;
+}
+
+struct adjust_plan *adjust_plan_create(float red_factor, float green_factor, float blue_factor,
+	int channels, int flags) {
+
+	struct adjust_plan *plan = malloc(sizeof(*plan));
+
+	if (plan != NULL && adjust_plan_init(plan, red_factor, green_factor, blue_factor, channels, flags) != 0) {
+		free(plan);
+		plan = NULL;
+	}
+	return plan;
+}
+
+void adjust_plan_destroy(struct adjust_plan *plan) {
+	free(plan);
+}
+
+const struct adjust_implementation *adjust_plan_implementation(const struct adjust_plan *plan) {
+	return plan->impl;
+}
+
+const char *adjust_plan_kernel(const struct adjust_plan *plan) {
+	return plan->kernel_name;
+}
+
+// ==================== Multithreading
+
+#define CACHE_LINE		64		// bytes
+#define MIN_BAND_PIXELS		(64 * 1024)	// don't bother splitting smaller images
+
+static struct adjust_pool *pool = NULL;
+
+int adjust_set_threads(int threads) {
+	if (threads <= 0) {
+		threads = sysconf(_SC_NPROCESSORS_ONLN);
+	}
+	if (pool != NULL && adjust_pool_threads(pool) == threads) {
+		return threads;
+	}
+	adjust_pool_destroy(pool);
+	pool = threads > 1 ? adjust_pool_create(threads) : NULL;
+	return pool != NULL ? adjust_pool_threads(pool) : 1;
+}
+
+void adjust_run_tasks(void (*task)(void *arg, int index), void *arg, int count) {
+	if (pool != NULL) {
+		adjust_pool_run(pool, task, arg, count);
+	} else {
+		for (int i = 0; i < count; i++) {
+			task(arg, i);
+		}
+	}
+}
+
+// ==================== Streaming stores
+//
+// An output larger than the last level cache can't still be in the cache when it is next
+// read, so writing it through the cache only evicts data that could be (including the
+// source rows still to be read) - and costs a read of each line before it is written.
+// Non-temporal stores (STNT1B, STNP) write around the caches instead. The structure stores
+// that the kernels use (ST3B, ST3) have no non-temporal form, so each chunk of a row is
+// adjusted into a small buffer that stays in L1, then copied out with plan->copy_nt.
+
+#define STAGE_BYTES		(16 * 1024)	// well inside any L1 data cache
+#define LLC_DEFAULT		(8 * 1024 * 1024)
+
+static _Thread_local unsigned char stage[STAGE_BYTES] __attribute__((aligned(CACHE_LINE)));
+
+static size_t llc_bytes = LLC_DEFAULT;
+static pthread_once_t llc_once = PTHREAD_ONCE_INIT;
+
+// Find the size of the largest cache (the cache with the highest level) from sysfs
+static void find_llc(void) {
+	int best_level = 0;
+
+	for (int index = 0; index < 16; index++) {
+		char name[80], units = 0;
+		int level;
+		unsigned long size;
+		FILE *f;
+
+		snprintf(name, sizeof(name), "/sys/devices/system/cpu/cpu0/cache/index%d/level", index);
+		if ((f = fopen(name, "r")) == NULL) {
+			break;
+		}
+		if (fscanf(f, "%d", &level) != 1) {
+			level = 0;
+		}
+		fclose(f);
+
+		snprintf(name, sizeof(name), "/sys/devices/system/cpu/cpu0/cache/index%d/size", index);
+		if (level <= best_level || (f = fopen(name, "r")) == NULL) {
+			continue;
+		}
+		if (fscanf(f, "%lu%c", &size, &units) >= 1 && size > 0) {
+			best_level = level;
+			llc_bytes = size << (units == 'K' ? 10 : units == 'M' ? 20 : 0);
+		}
+		fclose(f);
+	}
+}
+
+// ==================== Executing plans
+
+// A region of an image to adjust; src and dst point to its first pixel
+struct region {
+	const struct adjust_plan *plan;
+	const unsigned char	*src;
+	unsigned char		*dst;
+	size_t			src_stride, dst_stride;
+	size_t			width;		// pixels per row - a packed region is one row of all its pixels
+	int			height;
+	int			stream;		// write with non-temporal stores
+	size_t			band;		// pixels (one row) or rows per band, for threads
+};
+
+// Adjust a run of packed pixels
+static void run(const struct region *r, const unsigned char *src, unsigned char *dst, size_t pixels) {
+	const struct adjust_plan *plan = r->plan;
+	size_t bpp = plan->bytes_per_pixel;
+
+	if (!r->stream) {
+		if (plan->kernel != NULL) {
+			plan->kernel(plan, src, dst, pixels);
+		} else if (src != dst) {
+			memcpy(dst, src, pixels * bpp);
+		}
+	} else if (plan->kernel == NULL) {
+		plan->copy_nt(dst, src, pixels * bpp);
+	} else {
+		// Stage whole cache lines' worth of pixels at a time
+		size_t chunk = STAGE_BYTES / bpp / CACHE_LINE * CACHE_LINE;
+
+		for (size_t i = 0; i < pixels; i += chunk) {
+			size_t count = MIN(chunk, pixels - i);
+			plan->kernel(plan, src + i * bpp, stage, count);
+			plan->copy_nt(dst + i * bpp, stage, count * bpp);
+		}
+	}
+}
+
+// Adjust band 'index' - a range of pixels in a packed region, or of rows otherwise
+static void band_task(void *arg, int index) {
+	const struct region *r = arg;
+	size_t bpp = r->plan->bytes_per_pixel;
+
+	if (r->height == 1) {
+		size_t start = index * r->band;
+
+		if (start < r->width) {
+			run(r, r->src + start * bpp, r->dst + start * bpp, MIN(r->band, r->width - start));
+		}
+	} else {
+		for (size_t y = index * r->band; y < MIN((index + 1) * r->band, r->height); y++) {
+			run(r, r->src + y * r->src_stride, r->dst + y * r->dst_stride, r->width);
+		}
+	}
+}
+
+static int gcd(int a, int b) {
+	while (b != 0) {
+		int t = a % b;
+		a = b;
+		b = t;
+	}
+	return a;
+}
+
+// adjust_plan_execute_ex(), with strides that may be too large for an int
+static void execute(const struct adjust_plan *plan, const void *src, size_t src_stride,
+	void *dst, size_t dst_stride, int x0, int y0, int width, int height, int flags) {
+
+	size_t bpp = plan->bytes_per_pixel;
+	size_t row_bytes = width * bpp;
+	struct region r = { plan,
+		(const unsigned char *)src + y0 * src_stride + x0 * bpp,
+		(unsigned char *)dst + y0 * dst_stride + x0 * bpp,
+		src_stride, dst_stride, width, height };
+
+	if (width <= 0 || height <= 0 || (plan->kernel == NULL && src == dst)) {
+		return;
+	}
+
+	// Stream the output if asked to, or by default if it is out of place and too big
+	// to stay in the cache. In place, each line is already in the cache when it is
+	// written (it was just read), so there is nothing to gain.
+	pthread_once(&llc_once, find_llc);
+	r.stream = (flags & ADJUST_EX_STREAM) ||
+		(!(flags & ADJUST_EX_NO_STREAM) && src != dst && row_bytes * height > llc_bytes);
+
+	// Packed rows (no padding, and the full width) are one run of pixels
+	size_t pixels = (size_t)width * height;
+
+	if (src_stride == row_bytes && dst_stride == row_bytes) {
+		r.width = pixels;
+		r.height = 1;
+	}
+
+	if (pool == NULL || pixels < 2 * MIN_BAND_PIXELS) {
+		r.band = r.height == 1 ? r.width : r.height;
+		band_task(&r, 0);
+		return;
+	}
+
+	int bands = MIN(adjust_pool_threads(pool), pixels / MIN_BAND_PIXELS);
+
+	if (r.height == 1) {
+		// Bands start on a whole number of vectors (one vector's worth of lanes = one pixel
+		// per lane, since each channel gets its own register) and of cache lines. Split
+		// by rows, then round each band to the alignment.
+		int lanes = plan->vector_bytes * plan->channels / plan->bytes_per_pixel;
+		int align = lanes / gcd(lanes, CACHE_LINE) * CACHE_LINE;
+		int rows = (height + bands - 1) / bands;
+
+		r.band = ((size_t)rows * width + align - 1) / align * align;
+		adjust_pool_run(pool, band_task, &r, (r.width + r.band - 1) / r.band);
+	} else {
+		// Separate rows: each band is whole rows
+		r.band = (height + bands - 1) / bands;
+		adjust_pool_run(pool, band_task, &r, (height + r.band - 1) / r.band);
+	}
+}
+
+void adjust_plan_execute_ex(const struct adjust_plan *plan, const void *src, int src_stride,
+	void *dst, int dst_stride, int x0, int y0, int width, int height, int flags) {
+
+	execute(plan, src, src_stride, dst, dst_stride, x0, y0, width, height, flags);
+}
+
+void adjust_plan_execute(const struct adjust_plan *plan, void *image, int x_size, int y_size) {
+	size_t stride = (size_t)x_size * plan->bytes_per_pixel;
+
+	execute(plan, image, stride, image, stride, 0, 0, x_size, y_size, 0);
+}
+
+void adjust_channels_ex(const unsigned char *src, int src_stride, unsigned char *dst, int dst_stride,
+	int x0, int y0, int width, int height, float red_factor, float green_factor, float blue_factor) {
+
+	struct adjust_plan plan;
+
+	if (adjust_plan_init(&plan, red_factor, green_factor, blue_factor, 3, 0) == 0) {
+		adjust_plan_execute_ex(&plan, src, src_stride, dst, dst_stride, x0, y0, width, height, 0);
+	}
+}
+
+void adjust_channels(unsigned char *image, int x_size, int y_size, 
+	float red_factor, float green_factor, float blue_factor) {
+
+	struct adjust_plan plan;
+
+	if (adjust_plan_init(&plan, red_factor, green_factor, blue_factor, 3, 0) == 0) {
+		adjust_plan_execute(&plan, image, x_size, y_size);
+	}
+}
@@ -0,0 +1,106 @@
+// adjust_plan.h
+//
+// The contents of an adjust_plan - shared by adjust_plan.c, which fills
+// it in, and the implementations in adjust_channels.c, which read it.
+// Everything else should treat a plan as opaque.
+
+#ifndef ADJUST_PLAN_H
+#define ADJUST_PLAN_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "adjust_channels.h"
+
+// Per-channel operations for the factor-specialized implementations (#7, #8)
+enum adjust_op {
+	ADJUST_OP_MULTIPLY,			// general case: fixed-point multiply, as in #2
+	ADJUST_OP_IDENTITY,			// factor 1.0: leave unchanged
+	ADJUST_OP_SHIFT_RIGHT,			// factor 2^-shift (or 0.0, as a shift by 8): LSR
+	ADJUST_OP_DOUBLE,			// factor 2.0: saturating add of the value to itself
+};
+
+typedef void (*adjust_copy_fn)(void *dst, const void *src, size_t bytes);
+
+// Stages of a plan for an operation list (see adjust_ops.c), applied in this order
+#define ADJUST_STAGE_PRE_LUT	1		// per-channel lookup tables (plan->lut)
+#define ADJUST_STAGE_MATRIX	2		// 3x3 matrix and bias (plan->matrix, plan->bias)
+#define ADJUST_STAGE_POST_LUT	4		// per-channel lookup tables (plan->post_lut)
+
+#define ADJUST_MATRIX_SHIFT	12		// fractional bits of plan->matrix and plan->bias
+
+struct adjust_plan {
+	const struct adjust_implementation *impl;	// implementation that executes this plan
+	adjust_kernel_fn kernel;		// its kernel, or NULL if there is nothing to do
+	char		kernel_name[32];	// description of the kernel, for reports
+	int		channels;		// channels per pixel (1-4)
+	int		bytes_per_pixel;	// channels, or twice that for 16-bit images
+	float		factor[3];		// red/green/blue factors, 0.0-2.0 (#1) - grey uses factor[0]
+	uint8_t		fixed[3];		// factors in fixed point, 0-128 representing 0.0-2.0 (#2-#5, #10, #11)
+	uint16_t	fixed16[3];		// factors in 14-bit fixed point, rounded, 0-32768 (#9; 16-bit #4, #5)
+	int		vector_bytes;		// vector length of the implementation
+	int		elements3;		// largest multiple of 3 <= vector_bytes (#3)
+	uint8_t		factor_table[256];	// interleaved fixed-point factors, vector_bytes long (#3)
+	uint8_t		lut[3][512];		// per-channel lookup tables, padded to 512 bytes (#6)
+	int		op[3];			// per-channel operation (#7, #8)
+	int		shift[3];		// shift count for ADJUST_OP_SHIFT_RIGHT (#7, #8)
+	int		uniform;		// all three channels have the same operation and factor (#7, #8)
+	adjust_copy_fn	copy_nt;		// copy with non-temporal stores, for outputs larger than the LLC
+	int		stages;			// ADJUST_STAGE_* (operation lists)
+	int16_t		matrix[9];		// 3x3 matrix in fixed point, 2^ADJUST_MATRIX_SHIFT = 1.0 (operation lists)
+	int32_t		bias[3];		// ... and the value added to each row, in the same units
+	uint8_t		post_lut[3][512];	// per-channel tables after the matrix, padded as lut (operation lists)
+};
+
+// Fill in a plan (without allocating it), clamping the factors to 0.0-2.0 - returns 0, or -1
+// if the channel count or implementation isn't supported
+int adjust_plan_init(struct adjust_plan *plan, float red_factor, float green_factor, float blue_factor,
+	int channels, int flags);
+
+// The copy with non-temporal stores to use on this CPU (for plan->copy_nt)
+adjust_copy_fn adjust_find_copy_nt(void);
+
+// Copies with non-temporal stores (STNT1B, STNP, VMOVNTDQ) that bypass the caches (see adjust_channels.c)
+void adjust_sve_copy_nt(void *dst, const void *src, size_t bytes);
+void adjust_neon_copy_nt(void *dst, const void *src, size_t bytes);
+void adjust_avx2_copy_nt(void *dst, const void *src, size_t bytes);
+
+// Kernels for each implementation (see adjust_channels.c)
+void adjust_channels_naive(const struct adjust_plan *plan, const unsigned char *src, unsigned char *dst,
+	size_t pixels);
+void adjust_channels_ld3b(const struct adjust_plan *plan, const unsigned char *src, unsigned char *dst,
+	size_t pixels);
+void adjust_channels_interleaved(const struct adjust_plan *plan, const unsigned char *src, unsigned char *dst,
+	size_t pixels);
+void adjust_channels_acle(const struct adjust_plan *plan, const unsigned char *src, unsigned char *dst,
+	size_t pixels);
+void adjust_channels_neon(const struct adjust_plan *plan, const unsigned char *src, unsigned char *dst,
+	size_t pixels);
+void adjust_channels_lut(const struct adjust_plan *plan, const unsigned char *src, unsigned char *dst,
+	size_t pixels);
+void adjust_channels_sve2_fast(const struct adjust_plan *plan, const unsigned char *src, unsigned char *dst,
+	size_t pixels);
+void adjust_channels_neon_fast(const struct adjust_plan *plan, const unsigned char *src, unsigned char *dst,
+	size_t pixels);
+void adjust_channels_sve2_precise(const struct adjust_plan *plan, const unsigned char *src, unsigned char *dst,
+	size_t pixels);
+void adjust_channels_avx2(const struct adjust_plan *plan, const unsigned char *src, unsigned char *dst,
+	size_t pixels);
+void adjust_channels_avx512(const struct adjust_plan *plan, const unsigned char *src, unsigned char *dst,
+	size_t pixels);
+
+// Kernels for operation lists
+void adjust_ops_naive(const struct adjust_plan *plan, const unsigned char *src, unsigned char *dst,
+	size_t pixels);
+void adjust_ops_sve2(const struct adjust_plan *plan, const unsigned char *src, unsigned char *dst,
+	size_t pixels);
+
+// Kernels for 16 bits per channel ('src' and 'dst' point to uint16_t values)
+void adjust_channels_naive_u16(const struct adjust_plan *plan, const unsigned char *src, unsigned char *dst,
+	size_t pixels);
+void adjust_channels_acle_u16(const struct adjust_plan *plan, const unsigned char *src, unsigned char *dst,
+	size_t pixels);
+void adjust_channels_neon_u16(const struct adjust_plan *plan, const unsigned char *src, unsigned char *dst,
+	size_t pixels);
+
+#endif
@@ -0,0 +1,147 @@
+/*
+
+        adjust_threads :: a small persistent thread pool
+        
+        The worker threads are started once, when the pool is created, and
+        then sleep on a condition variable between jobs - so running a job
+        costs a wakeup rather than a pthread_create() per thread.
+        
+        A job is a function and a count of tasks; the tasks are handed out
+        one at a time to whichever thread asks next (the calling thread
+        takes tasks too), and adjust_pool_run() returns once every task has
+        finished. The pool runs one job at a time: a job posted while
+        another is running (from another thread, or from inside one of its
+        tasks) is run on the calling thread alone, rather than waiting.
+        
+        Copyright (C)2022 Seneca College of Applied Arts and Technology
+        Written by Chris Tyler
+        Distributed under the terms of the GNU GPL v2
+        
+*/
+
+#include <pthread.h>
+#include <stdlib.h>
+
+#include "adjust_threads.h"
+
+struct adjust_pool {
+	pthread_mutex_t		run;		// held by the caller of adjust_pool_run() for its whole job
+	pthread_mutex_t		lock;
+	pthread_cond_t		start;		// signalled when a new job is posted (or on shutdown)
+	pthread_cond_t		done;		// signalled when the last task of a job finishes
+	pthread_t		*workers;
+	int			worker_count;	// threads in addition to the caller
+	int			stopping;
+
+	unsigned		generation;	// incremented for each job
+	void			(*task)(void *arg, int index);
+	void			*arg;
+	int			tasks;		// number of tasks in the current job
+	int			next;		// next task to hand out
+	int			finished;	// tasks completed so far
+};
+
+// Run tasks from the current job until there are none left (called with the lock held)
+static void run_tasks(struct adjust_pool *pool) {
+	while (pool->next < pool->tasks) {
+		int index = pool->next++;
+
+		pthread_mutex_unlock(&pool->lock);
+		pool->task(pool->arg, index);
+		pthread_mutex_lock(&pool->lock);
+
+		if (++pool->finished == pool->tasks) {
+			pthread_cond_broadcast(&pool->done);
+		}
+	}
+}
+
+static void *worker(void *arg) {
+	struct adjust_pool *pool = arg;
+	unsigned seen = 0;
+
+	pthread_mutex_lock(&pool->lock);
+	for (;;) {
+		while (!pool->stopping && pool->generation == seen) {
+			pthread_cond_wait(&pool->start, &pool->lock);
+		}
+		if (pool->stopping) {
+			break;
+		}
+		seen = pool->generation;
+		run_tasks(pool);
+	}
+	pthread_mutex_unlock(&pool->lock);
+	return NULL;
+}
+
+struct adjust_pool *adjust_pool_create(int threads) {
+	struct adjust_pool *pool = calloc(1, sizeof(*pool));
+
+	if (pool == NULL) {
+		return NULL;
+	}
+	pthread_mutex_init(&pool->run, NULL);
+	pthread_mutex_init(&pool->lock, NULL);
+	pthread_cond_init(&pool->start, NULL);
+	pthread_cond_init(&pool->done, NULL);
+
+	pool->workers = calloc(threads > 1 ? threads - 1 : 1, sizeof(pthread_t));
+	for (int i = 0; i < threads - 1; i++) {
+		if (pthread_create(&pool->workers[i], NULL, worker, pool) != 0) {
+			break;
+		}
+		pool->worker_count++;
+	}
+	return pool;
+}
+
+void adjust_pool_run(struct adjust_pool *pool, void (*task)(void *arg, int index), void *arg, int count) {
+	// The pool is busy with another job: run this one here
+	if (pthread_mutex_trylock(&pool->run) != 0) {
+		for (int i = 0; i < count; i++) {
+			task(arg, i);
+		}
+		return;
+	}
+
+	pthread_mutex_lock(&pool->lock);
+	pool->task = task;
+	pool->arg = arg;
+	pool->tasks = count;
+	pool->next = 0;
+	pool->finished = 0;
+	pool->generation++;
+	pthread_cond_broadcast(&pool->start);
+
+	run_tasks(pool);
+	while (pool->finished < pool->tasks) {
+		pthread_cond_wait(&pool->done, &pool->lock);
+	}
+	pthread_mutex_unlock(&pool->lock);
+	pthread_mutex_unlock(&pool->run);
+}
+
+int adjust_pool_threads(struct adjust_pool *pool) {
+	return pool->worker_count + 1;
+}
+
+void adjust_pool_destroy(struct adjust_pool *pool) {
+	if (pool == NULL) {
+		return;
+	}
+	pthread_mutex_lock(&pool->lock);
+	pool->stopping = 1;
+	pthread_cond_broadcast(&pool->start);
+	pthread_mutex_unlock(&pool->lock);
+
+	for (int i = 0; i < pool->worker_count; i++) {
+		pthread_join(pool->workers[i], NULL);
+	}
+	pthread_cond_destroy(&pool->start);
+	pthread_cond_destroy(&pool->done);
+	pthread_mutex_destroy(&pool->lock);
+	pthread_mutex_destroy(&pool->run);
+	free(pool->workers);
+	free(pool);
+}
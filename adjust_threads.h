@@ -0,0 +1,21 @@
+// adjust_threads.h
+
+#ifndef ADJUST_THREADS_H
+#define ADJUST_THREADS_H
+
+// A persistent pool of worker threads (see adjust_threads.c)
+struct adjust_pool;
+
+// Create a pool that runs tasks on 'threads' threads in total (including the caller)
+struct adjust_pool *adjust_pool_create(int threads);
+
+// Run task(arg, 0) .. task(arg, count - 1) across the pool, returning when all are done.
+// If the pool is already running a job, the tasks are run on the calling thread instead.
+void adjust_pool_run(struct adjust_pool *pool, void (*task)(void *arg, int index), void *arg, int count);
+
+// Number of threads (including the caller) that the pool runs tasks on
+int adjust_pool_threads(struct adjust_pool *pool);
+
+void adjust_pool_destroy(struct adjust_pool *pool);
+
+#endif
@@ -7,17 +7,42 @@
   
 */
 
+#include <ctype.h>
+#include <errno.h>
+#include <glob.h>
+#include <limits.h>
 #include <math.h>
+#include <pthread.h>
+#include <signal.h>
 #include <stdio.h>
+#include <stdint.h>
 #include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+#include <unistd.h>
 #include <sys/param.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
 
 // adjust_channels is where all the real action is
 // this file is just scaffolding!
 #include "adjust_channels.h"
+#include "image_arena.h"
+#include "image_map.h"
+#include "pnm_stream.h"
+#include "video_stream.h"
 
 // Using the STBI image reader/writer
 // See https://github.com/nothings/stb
+// (with their buffers in a per-thread arena in batch mode - see image_arena.c)
+#define STBI_MALLOC(size)		image_arena_malloc(size)
+#define STBI_REALLOC(p, size)		image_arena_realloc(p, size)
+#define STBI_FREE(p)			image_arena_free(p)
+#define STBIW_MALLOC(size)		image_arena_malloc(size)
+#define STBIW_REALLOC(p, size)		image_arena_realloc(p, size)
+#define STBIW_FREE(p)			image_arena_free(p)
 #define STBI_NO_LINEAR
 #define STBI_NO_HDR
 #define STB_IMAGE_IMPLEMENTATION
@@ -25,41 +50,1429 @@
 #define STB_IMAGE_WRITE_IMPLEMENTATION
 #include <stb_image_write.h>
 
-int main(int argc, char *argv[]) {
+// ==================== 16-bit PNG output
+//
+// stb_image_write only writes 8 bits per channel, so 16-bit images are written
+// here: the PNG chunks are simple enough, and stb_image_write's zlib compressor
+// (stbi_zlib_compress) does the IDAT data. Rows are stored unfiltered.
 
-	// ==================== Check arg count
-	if (argc != 6) {
-		dprintf(2, "\nUsage: %s input.jpg red green blue output.jpg\nWhere red/green/blue are in the range 0.0-2.0\n", argv[0]);
-		return 1;
+static uint32_t crc_table[256];
+static pthread_once_t crc_once = PTHREAD_ONCE_INIT;
+
+static void make_crc_table(void) {
+	for (uint32_t n = 0; n < 256; n++) {
+		uint32_t c = n;
+		for (int k = 0; k < 8; k++) {
+			c = c & 1 ? 0xedb88320 ^ (c >> 1) : c >> 1;
+		}
+		crc_table[n] = c;
 	}
+}
 
-	// ==================== Load the image file (arg 1)
-	int x, y, n;
-	unsigned char *image = stbi_load(argv[1], 
-		&x, &y, &n, 3);
+static uint32_t png_crc(uint32_t crc, const unsigned char *data, size_t len) {
+	pthread_once(&crc_once, make_crc_table);
+	crc = ~crc;
+	for (size_t i = 0; i < len; i++) {
+		crc = crc_table[(crc ^ data[i]) & 0xff] ^ (crc >> 8);
+	}
+	return ~crc;
+}
 
-	if (image == NULL) {
-		dprintf(2, "Invalid argument or input image file did not load.\n");
-		dprintf(2, "\nUsage: %s input.jpg red green blue output.jpg\nWhere red/green/blue are in the range 0.0-2.0\n", argv[0]);
+static void put_u32(unsigned char *p, uint32_t v) {
+	p[0] = v >> 24;
+	p[1] = v >> 16;
+	p[2] = v >> 8;
+	p[3] = v;
+}
+
+// Write one chunk: length, type, data, and the CRC of the type and data
+static int write_chunk(FILE *f, const char *type, const unsigned char *data, uint32_t len) {
+	unsigned char head[8], tail[4];
+
+	put_u32(head, len);
+	memcpy(head + 4, type, 4);
+	put_u32(tail, png_crc(png_crc(0, head + 4, 4), data, len));
+	return fwrite(head, 8, 1, f) == 1 && (len == 0 || fwrite(data, len, 1, f) == 1) &&
+		fwrite(tail, 4, 1, f) == 1;
+}
+
+// Returns nonzero on success, like the stbi_write_* functions
+static int write_png16(const char *filename, int x, int y, int n, const uint16_t *image) {
+	static const unsigned char signature[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n' };
+	static const unsigned char colour_type[5] = { 0, 0, 4, 2, 6 };	// grey, grey + alpha, RGB, RGBA
+	size_t row = (size_t)x * n * 2 + 1;				// filter type byte + big-endian samples
+	unsigned char *raw = image_arena_malloc(row * y);
+	unsigned char header[13];
+	unsigned char *zlib;
+	int zlib_len, ok;
+	FILE *f;
+
+	if (raw == NULL) {
+		return 0;
+	}
+	for (int j = 0; j < y; j++) {
+		unsigned char *out = raw + j * row;
+		const uint16_t *in = image + (size_t)j * x * n;
+
+		*out++ = 0;						// filter: none
+		for (size_t i = 0; i < (size_t)x * n; i++) {
+			*out++ = in[i] >> 8;
+			*out++ = in[i];
+		}
+	}
+	zlib = stbi_zlib_compress(raw, row * y, &zlib_len, 8);
+	image_arena_free(raw);
+	if (zlib == NULL) {
+		return 0;
+	}
+
+	put_u32(header, x);
+	put_u32(header + 4, y);
+	header[8] = 16;							// bit depth
+	header[9] = colour_type[n];
+	header[10] = header[11] = header[12] = 0;			// compression, filter, interlace
+
+	f = fopen(filename, "wb");
+	ok = f != NULL && fwrite(signature, 8, 1, f) == 1 &&
+		write_chunk(f, "IHDR", header, 13) &&
+		write_chunk(f, "IDAT", zlib, zlib_len) &&
+		write_chunk(f, "IEND", NULL, 0);
+	if (f != NULL && fclose(f) != 0) {
+		ok = 0;
+	}
+	STBIW_FREE(zlib);
+	return ok;
+}
+
+// ==================== Parallel JPEG output
+//
+// Once the adjustment is vectorized and spread across threads, stbi_write_jpg() - colour
+// conversion, DCT, quantization and Huffman coding, all on one thread - takes most of the
+// time. But a baseline JPEG can be cut into independently coded pieces with restart markers:
+// at each RSTn marker a decoder resets the DC predictions and resumes on a byte boundary,
+// just as at the start of the image. So with more than one thread the image is split into
+// horizontal slices on MCU row boundaries, each slice is encoded as a JPEG of its own by
+// stbi_write_jpg_to_func() on the thread pool, and the slices are stitched together:
+//
+//	the headers of the first slice, with the full height in SOF0, and a DRI (define
+//	restart interval) segment of one slice's worth of MCUs;
+//	the entropy-coded data of each slice, with RST0 .. RST7 in turn between them;
+//	EOI
+//
+// Every MCU is coded from the same pixels as in a single encode (slices are whole MCU rows,
+// so no edge padding moves), so the image decodes identically, in a file a few bytes per
+// slice larger. Colour conversion and the DCT are still stb_image_write's scalar code, now
+// on every core.
+
+#define JPEG_SLICE_ROWS		16		// MCU height with 4:2:0 subsampling (two MCUs at 4:4:4)
+#define JPEG_MIN_SLICE_PIXELS	(128 * 1024)	// don't bother splitting smaller images
+#define JPEG_SLICES_PER_THREAD	4		// for load balancing: slices don't all take as long
+
+struct jpeg_slice {
+	unsigned char	*data;
+	size_t		length, size;
+	int		failed;
+};
+
+struct jpeg_job {
+	const unsigned char	*image;
+	int			x, y, n, quality;
+	int			rows;		// per slice
+	struct jpeg_slice	*slice;
+};
+
+static void jpeg_append(void *context, void *data, int size) {
+	struct jpeg_slice *slice = context;
+
+	if (slice->length + size > slice->size) {
+		size_t bigger = MAX(slice->size * 2, slice->length + size);
+		unsigned char *more = realloc(slice->data, bigger);
+
+		if (more == NULL) {
+			slice->failed = 1;
+			return;
+		}
+		slice->data = more;
+		slice->size = bigger;
+	}
+	memcpy(slice->data + slice->length, data, size);
+	slice->length += size;
+}
+
+static void jpeg_slice_task(void *arg, int index) {
+	struct jpeg_job *job = arg;
+	struct jpeg_slice *slice = &job->slice[index];
+	int row = index * job->rows;
+
+	if (!stbi_write_jpg_to_func(jpeg_append, slice, job->x, MIN(job->rows, job->y - row), job->n,
+	    job->image + (size_t)row * job->x * job->n, job->quality)) {
+		slice->failed = 1;
+	}
+}
+
+// The offset of marker 'code' among the header segments of a JPEG stream (which end at
+// SOS), or 0 if it isn't there
+static size_t jpeg_find(const struct jpeg_slice *slice, int code) {
+	const unsigned char *data = slice->data;
+
+	size_t at = 2;							// after SOI
+
+	while (at + 4 <= slice->length && data[at] == 0xff) {
+		if (data[at + 1] == code) {
+			return at;
+		}
+		if (data[at + 1] == 0xda) {
+			break;
+		}
+		at += 2 + (data[at + 2] << 8 | data[at + 3]);
+	}
+	return 0;
+}
+
+// Stitch the slices into one JPEG file as above. Returns nonzero on success.
+static int write_jpg_slices(const char *filename, const struct jpeg_job *job, int slices) {
+	const struct jpeg_slice *first = &job->slice[0];
+	const unsigned char *head = first->data;
+	size_t sof = jpeg_find(first, 0xc0), sos = jpeg_find(first, 0xda);
+
+	if (sof == 0 || sos == 0) {
+		return 0;
+	}
+
+	// The MCU size follows from the largest sampling factors of the components - except
+	// in a scan of one component, where an MCU is one 8x8 block
+	int h = 1, v = 1;
+
+	for (int c = 0; head[sos + 4] > 1 && c < head[sof + 9]; c++) {
+		h = MAX(h, head[sof + 11 + c * 3] >> 4);
+		v = MAX(v, head[sof + 11 + c * 3] & 15);
+	}
+	size_t interval = (size_t)(job->x + h * 8 - 1) / (h * 8) * (job->rows / (v * 8));
+
+	if (job->rows % (v * 8) != 0 || interval > 65535) {
+		return 0;
+	}
+
+	// The entropy-coded data of a slice follows its SOS segment, and ends before its EOI
+	size_t data[slices];
+
+	for (int s = 0; s < slices; s++) {
+		const struct jpeg_slice *slice = &job->slice[s];
+		size_t at = jpeg_find(slice, 0xda);
+
+		data[s] = at + 2 + (slice->data[at + 2] << 8 | slice->data[at + 3]);
+		if (at == 0 || data[s] + 2 > slice->length || slice->data[slice->length - 2] != 0xff ||
+		    slice->data[slice->length - 1] != 0xd9) {
+			return 0;
+		}
+	}
+
+	unsigned char height[2] = { job->y >> 8, job->y };
+	unsigned char dri[6] = { 0xff, 0xdd, 0, 4, interval >> 8, interval };
+	unsigned char marker[2] = { 0xff, 0xd9 };
+	FILE *f = fopen(filename, "wb");
+	int ok = f != NULL &&
+		fwrite(head, sof + 5, 1, f) == 1 &&			// up to SOF0's height
+		fwrite(height, 2, 1, f) == 1 &&
+		fwrite(head + sof + 7, sos - sof - 7, 1, f) == 1 &&	// the other headers
+		fwrite(dri, 6, 1, f) == 1 &&
+		fwrite(head + sos, data[0] - sos, 1, f) == 1;		// SOS
+
+	for (int s = 0; ok && s < slices; s++) {
+		const struct jpeg_slice *slice = &job->slice[s];
+
+		if (s > 0) {
+			marker[1] = 0xd0 + (s - 1) % 8;			// RSTn
+			ok = fwrite(marker, 2, 1, f) == 1;
+		}
+		ok = ok && fwrite(slice->data + data[s], slice->length - 2 - data[s], 1, f) == 1;
+	}
+	marker[1] = 0xd9;						// EOI
+	ok = ok && fwrite(marker, 2, 1, f) == 1;
+	if (f != NULL && fclose(f) != 0) {
+		ok = 0;
+	}
+	return ok;
+}
+
+// Write a JPEG file, on the thread pool if there is one; returns nonzero on success
+static int write_jpg(const char *filename, int x, int y, int n, const unsigned char *image, int quality,
+	int threads) {
+
+	int strips = (y + JPEG_SLICE_ROWS - 1) / JPEG_SLICE_ROWS;
+	int slices = MIN(threads * JPEG_SLICES_PER_THREAD, (size_t)x * y / JPEG_MIN_SLICE_PIXELS);
+
+	// The restart interval (the MCUs in a slice) can't be more than 65535: a strip of
+	// JPEG_SLICE_ROWS is at most two rows of 8x8 MCUs
+	int strips_per_slice = 65535 / ((x + 7) / 8 * 2);
+
+	if (threads <= 1 || strips_per_slice == 0 || strips < 2) {
+		return stbi_write_jpg(filename, x, y, n, image, quality);
+	}
+	slices = MAX(slices, (strips + strips_per_slice - 1) / strips_per_slice);
+	if (slices < 2) {
+		return stbi_write_jpg(filename, x, y, n, image, quality);
+	}
+
+	struct jpeg_job job = { image, x, y, n, quality };
+	int ok = 1;
+
+	job.rows = (strips + slices - 1) / slices * JPEG_SLICE_ROWS;
+	slices = (y + job.rows - 1) / job.rows;
+	job.slice = calloc(slices, sizeof(*job.slice));
+	if (job.slice == NULL) {
+		return 0;
+	}
+
+	adjust_run_tasks(jpeg_slice_task, &job, slices);
+	for (int s = 0; s < slices; s++) {
+		ok &= !job.slice[s].failed;
+	}
+	ok = ok && write_jpg_slices(filename, &job, slices);
+
+	for (int s = 0; s < slices; s++) {
+		free(job.slice[s].data);
+	}
+	free(job.slice);
+	return ok;
+}
+
+// ==================== Raw and Netpbm output (see image_map.c)
+
+#define MAPPED_BAND_BYTES	(256 * 1024)	// per thread: adjusted while still in cache after the copy
+
+// The header for writing an image to 'name' (an IMAGE_PNM or IMAGE_RAW file): .pgm and .ppm
+// for 1 and 3 channels, .pam for any, .pnm for whichever suits, and raw for 8 bits with the
+// channels given by the extension. Returns -1 if the format can't hold the image.
+static int output_header(const char *name, int x, int y, int channels, int maxval, struct pnm_header *header) {
+	const char *extension = strrchr(name, '.');
+	enum image_format format = image_format(name);
+
+	*header = (struct pnm_header){ 7, x, y, channels, maxval };
+	if (format == IMAGE_RAW) {
+		header->format = 0;
+		return image_raw_channels(name) == channels && maxval <= 255 ? 0 : -1;
+	}
+	if (format != IMAGE_PNM) {
+		return -1;
+	}
+	if (strcasecmp(extension, ".pam") != 0 && (channels == 1 || channels == 3)) {
+		header->format = channels == 1 ? 5 : 6;
+	}
+	if ((strcasecmp(extension, ".pgm") == 0 && channels != 1) ||
+	    (strcasecmp(extension, ".ppm") == 0 && channels != 3)) {
+		return -1;
+	}
+	return 0;
+}
+
+// Adjust the pixels of a mapped file from 'src' into 'dst' (which may be the same memory).
+// 8-bit samples are adjusted straight from one mapping to the other. Otherwise the image is
+// adjusted a band of rows at a time, so that each band is adjusted while it is still in cache
+// after being copied: 16-bit samples are big-endian in the file, so they are swapped to native
+// order and back around the adjustment, and samples are clamped to a maxval below 255/65535.
+static void adjust_mapped(const struct adjust_plan *plan, const unsigned char *src,
+	struct image_map *dst, int threads) {
+
+	const struct pnm_header *header = &dst->header;
+	size_t row_bytes = (size_t)header->width * pnm_bytes_per_pixel(header);
+	int band_rows = MAX(1, (size_t)MAPPED_BAND_BYTES * threads / row_bytes);
+
+	if (header->maxval == 255) {
+		adjust_plan_execute_ex(plan, src, row_bytes, dst->pixels, row_bytes,
+			0, 0, header->width, header->height, 0);
+		return;
+	}
+
+	for (int row = 0; row < header->height; row += band_rows) {
+		int rows = MIN(band_rows, header->height - row);
+		size_t offset = row * row_bytes, bytes = rows * row_bytes;
+
+		if (src != dst->pixels) {
+			memcpy(dst->pixels + offset, src + offset, bytes);
+		}
+		if (header->maxval > 255) {
+			pnm_swap16(dst->pixels + offset, bytes);
+		}
+		adjust_plan_execute(plan, dst->pixels + offset, header->width, rows);
+		if (header->maxval != 65535) {
+			pnm_clamp(dst->pixels + offset, bytes, header->maxval);
+		}
+		if (header->maxval > 255) {
+			pnm_swap16(dst->pixels + offset, bytes);
+		}
+	}
+}
+
+// Write an image from memory to a raw or Netpbm file; returns nonzero on success
+static int write_mapped(const char *name, int x, int y, int n, int maxval, const void *image) {
+	struct pnm_header header;
+	struct image_map map;
+
+	if (output_header(name, x, y, n, maxval, &header) != 0) {
+		dprintf(2, "'%s': this format can't hold %d channels of %d bits.\n", name, n, maxval > 255 ? 16 : 8);
+		return 0;
+	}
+	if (image_map_output(name, &header, &map) != 0) {
+		return 0;
+	}
+	size_t bytes = (size_t)x * y * pnm_bytes_per_pixel(&header);
+
+	memcpy(map.pixels, image, bytes);
+	if (maxval > 255) {
+		pnm_swap16(map.pixels, bytes);
+	}
+	return image_unmap(&map) == 0;
+}
+
+static void print_plan(const struct adjust_plan *plan) {
+	printf("Using adjust_channels() implementation #%d - %s (%s)\n",
+		adjust_plan_implementation(plan)->number, adjust_plan_implementation(plan)->description,
+		adjust_plan_kernel(plan));
+}
+
+// ==================== Plan caches
+//
+// A worker that adjusts many images (in batch or server mode) keeps the plans for the
+// last few combinations of factors and image layout, so that a run of images with the
+// same factors only pays for planning once.
+
+#define PLAN_CACHE		8
+
+struct plan_cache {
+	struct {
+		float			factor[3];
+		int			channels, flags;
+		struct adjust_plan	*plan;
+	} entry[PLAN_CACHE];
+	int		next;			// entry to replace next
+};
+
+// Operations to apply after the factors (--ops - see adjust_ops.c), or NULL
+static const char *plan_ops;
+
+// Make a plan for the factors, followed by plan_ops if there are any. Operation lists
+// are for 8-bit RGB images only, so other images get the factors alone.
+static struct adjust_plan *make_plan(float red, float green, float blue, int channels, int flags) {
+	struct adjust_ops *ops;
+	struct adjust_plan *plan = NULL;
+
+	if (plan_ops == NULL || channels != 3 || (flags & ADJUST_PLAN_16BIT)) {
+		return adjust_plan_create(red, green, blue, channels, flags);
+	}
+	ops = adjust_ops_create();
+	if (ops != NULL && adjust_ops_scale(ops, red, green, blue) == 0 && adjust_ops_parse(ops, plan_ops) == 0) {
+		plan = adjust_ops_plan(ops, flags);
+	}
+	adjust_ops_destroy(ops);
+	return plan != NULL ? plan : adjust_plan_create(red, green, blue, channels, flags);
+}
+
+// Get a plan from the cache (or, if 'cache' is NULL, create one)
+static struct adjust_plan *get_plan(struct plan_cache *cache, float red, float green, float blue,
+	int channels, int flags) {
+
+	if (cache == NULL) {
+		return make_plan(red, green, blue, channels, flags);
+	}
+	for (int e = 0; e < PLAN_CACHE; e++) {
+		if (cache->entry[e].plan != NULL && cache->entry[e].factor[0] == red &&
+		    cache->entry[e].factor[1] == green && cache->entry[e].factor[2] == blue &&
+		    cache->entry[e].channels == channels && cache->entry[e].flags == flags) {
+			return cache->entry[e].plan;
+		}
+	}
+
+	int e = cache->next;
+
+	cache->next = (e + 1) % PLAN_CACHE;
+	adjust_plan_destroy(cache->entry[e].plan);
+	cache->entry[e].plan = make_plan(red, green, blue, channels, flags);
+	cache->entry[e].factor[0] = red;
+	cache->entry[e].factor[1] = green;
+	cache->entry[e].factor[2] = blue;
+	cache->entry[e].channels = channels;
+	cache->entry[e].flags = flags;
+	return cache->entry[e].plan;
+}
+
+// Finish with a plan from get_plan()
+static void put_plan(struct plan_cache *cache, struct adjust_plan *plan) {
+	if (cache == NULL) {
+		adjust_plan_destroy(plan);
+	}
+}
+
+static void free_plans(struct plan_cache *cache) {
+	for (int e = 0; e < PLAN_CACHE; e++) {
+		adjust_plan_destroy(cache->entry[e].plan);
+	}
+}
+
+// ==================== Automatic white balance (--auto)
+//
+// Each image's own factors are found from its statistics (see adjust_stats.c) - counted
+// on the same threads, just before the adjust pass - and multiplied by the factors given
+// on the command line (1.0 if there are none).
+
+#define AUTO_CLIP		0.005		// fraction of each channel that may saturate (stretch)
+
+static int auto_method = -1;		// ADJUST_AUTO_*, or -1 to use the factors as given
+static const char *auto_names[] = { "gray world", "stretch" };
+
+// Apply automatic white balance (if --auto was given) to 'factor', for an image laid out
+// as adjust_image_stats() expects
+static void auto_balance(const void *image, int x, int y, int n, int flags, float *factor, int quiet) {
+	struct adjust_stats stats;
+	struct timespec start, end;
+	float balance[3];
+
+	if (auto_method < 0) {
+		return;
+	}
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	if (adjust_image_stats(image, x, y, n, 0, flags, &stats) != 0) {
+		dprintf(2, "Could not count the image statistics - not balancing it.\n");
+		return;
+	}
+	adjust_auto_factors(&stats, auto_method, AUTO_CLIP, balance);
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	for (int c = 0; c < 3; c++) {
+		factor[c] = MIN(2, factor[c] * balance[c]);
+	}
+	if (!quiet) {
+		printf("Automatic white balance (%s, from %llu pixels in %.2f ms):\tred: %8.6f   green: %8.6f   blue: %8.6f\n",
+			auto_names[auto_method], (unsigned long long)stats.samples,
+			(end.tv_sec - start.tv_sec) * 1e3 + (end.tv_nsec - start.tv_nsec) / 1e6,
+			factor[0], factor[1], factor[2]);
+	}
+}
+
+// ==================== Streaming (--stream)
+//
+// Netpbm (PGM/PPM/PAM) in and out, a strip of rows at a time, with reading,
+// adjusting and writing overlapped on separate threads (see pnm_stream.c) -
+// so the memory used doesn't depend on the height of the image.
+
+static int stream_image(const char *in_name, const char *out_name, float red, float green, float blue,
+	int flags, int rows) {
+
+	struct pnm_header header;
+	struct adjust_plan *plan = NULL;
+	FILE *in = fopen(in_name, "rb");
+	FILE *out;
+	int status = 0;
+
+	if (in == NULL || pnm_read_header(in, &header) != 0) {
+		dprintf(2, "'%s' is not a binary PGM, PPM or PAM file (required by --stream).\n", in_name);
+		status = 2;
+	} else {
+		printf("File '%s' opened: %dx%d pixels, %d channels of %d bits, streaming %d rows at a time.\n",
+			in_name, header.width, header.height, header.channels, header.maxval > 255 ? 16 : 8, rows);
+
+		plan = get_plan(NULL, red, green, blue, header.channels,
+			flags | (header.maxval > 255 ? ADJUST_PLAN_16BIT : 0));
+		print_plan(plan);
+
+		out = fopen(out_name, "wb");
+		if (out == NULL) {
+			dprintf(2, "Could not create '%s'.\n", out_name);
+			status = 3;
+		} else {
+			int failed = pnm_write_header(out, &header) != 0 ||
+				pnm_stream_adjust(in, out, &header, plan, rows) != 0;
+
+			if (fclose(out) != 0 || failed) {
+				dprintf(2, "Error reading '%s' or writing '%s'.\n", in_name, out_name);
+				status = 3;
+			}
+		}
+	}
+
+	if (in != NULL) {
+		fclose(in);
+	}
+	if (plan != NULL) {
+		put_plan(NULL, plan);
+	}
+	return status;
+}
+
+// ==================== Adjusting one file
+//
+// Returns 0, or the exit status: 2 if the input didn't load, 3 if the output couldn't be
+// written. Progress messages are left out if 'quiet'; errors always go to stderr. Plans
+// come from 'plans' (NULL to make a new one). '*pixels' is set to the number of pixels
+// adjusted.
+
+static int adjust_file(const char *in_name, const char *out_name, float red, float green, float blue,
+	int flags, int raw_x, int raw_y, int threads, struct plan_cache *plans, int quiet, size_t *pixels) {
+
+	// ==================== Raw and Netpbm files in and out: map them and adjust in place
+	struct pnm_header raw = { 0, raw_x, raw_y, image_raw_channels(in_name), 255 };
+	struct pnm_header out_header;
+	struct image_map in_map, out_map;
+	struct stat in_stat, out_stat;
+	float factor[3] = { red, green, blue };
+
+	*pixels = 0;
+	if (raw.channels != 0 && (raw_x <= 0 || raw_y <= 0)) {
+		dprintf(2, "The size of a raw input file must be given with --raw-size=WxH.\n");
+		return 2;
+	}
+
+	// (the output may be the same file as the input, in which case it's adjusted in place)
+	int same = stat(in_name, &in_stat) == 0 && stat(out_name, &out_stat) == 0 &&
+		in_stat.st_dev == out_stat.st_dev && in_stat.st_ino == out_stat.st_ino;
+	int mapped = image_map_input(in_name, raw.channels != 0 ? &raw : NULL, same, &in_map) == 0;
+
+	if (raw.channels != 0 && !mapped) {
+		dprintf(2, "Raw input file '%s' did not load (or is smaller than its size).\n", in_name);
 		return 2;
 	}
-	printf("File '%s' loaded: %dx%d pixels, %d bytes per pixel.\n", argv[1], x, y, n);
+	if (mapped && !quiet) {
+		printf("File '%s' mapped: %dx%d pixels, %d channels of %d bits.\n", in_name, in_map.header.width,
+			in_map.header.height, in_map.header.channels, in_map.header.maxval > 255 ? 16 : 8);
+	}
+
+	if (mapped && output_header(out_name, in_map.header.width, in_map.header.height,
+	    in_map.header.channels, in_map.header.maxval, &out_header) == 0 &&
+	    pnm_bytes_per_pixel(&out_header) == pnm_bytes_per_pixel(&in_map.header)) {
+
+		if (same) {
+			out_map = in_map;
+		} else if (image_map_output(out_name, &out_header, &out_map) != 0) {
+			dprintf(2, "Could not create '%s'.\n", out_name);
+			image_unmap(&in_map);
+			return 3;
+		}
+
+		int wide = in_map.header.maxval > 255 ? ADJUST_PLAN_16BIT : 0;
+
+		auto_balance(in_map.pixels, in_map.header.width, in_map.header.height, in_map.header.channels,
+			wide | ADJUST_STATS_BIG_ENDIAN, factor, quiet);
+
+		struct adjust_plan *plan = get_plan(plans, factor[0], factor[1], factor[2], in_map.header.channels,
+			flags | wide);
+		if (!quiet) {
+			print_plan(plan);
+		}
+		adjust_mapped(plan, in_map.pixels, &out_map, threads);
+		put_plan(plans, plan);
+		*pixels = (size_t)in_map.header.width * in_map.header.height;
+
+		if (!same) {
+			image_unmap(&in_map);
+		}
+		if (image_unmap(&out_map) != 0) {
+			dprintf(2, "Could not write '%s'.\n", out_name);
+			return 3;
+		}
+		return 0;
+	}
 
+	// ==================== Load the image file
+	// (with the file's own channels - grey, grey + alpha, RGB, or RGBA - and depth; the
+	// buffer comes from the arena in batch mode, or else from malloc())
+	int x, y, n, bits;
+	void *image;
+
+	if (mapped) {
+		// A Netpbm file going to another format: copy it out of the mapping
+		size_t bytes = (size_t)in_map.header.width * in_map.header.height * pnm_bytes_per_pixel(&in_map.header);
+
+		x = in_map.header.width;
+		y = in_map.header.height;
+		n = in_map.header.channels;
+		bits = in_map.header.maxval > 255 ? 16 : 8;
+		image = image_arena_malloc(bytes);
+		if (image != NULL) {
+			memcpy(image, in_map.pixels, bytes);
+			if (bits == 16) {
+				pnm_swap16(image, bytes);
+			}
+		}
+		image_unmap(&in_map);
+	} else {
+		bits = stbi_is_16_bit(in_name) ? 16 : 8;
+		image = bits == 16 ? (void *)stbi_load_16(in_name, &x, &y, &n, 0) :
+			(void *)stbi_load(in_name, &x, &y, &n, 0);
+	}
+
+	if (image == NULL) {
+		dprintf(2, "Invalid argument or input image file '%s' did not load.\n", in_name);
+		return 2;
+	}
+	if (!mapped && !quiet) {
+		printf("File '%s' loaded: %dx%d pixels, %d channels of %d bits.\n", in_name, x, y, n, bits);
+	}
 
-	
 	// ==================== Adjust the channels
-	
-	// Get arguments 2, 3, and 4; each should be a number in the range 0.0 .. 2.0
+	auto_balance(image, x, y, n, bits == 16 ? ADJUST_PLAN_16BIT : 0, factor, quiet);
+
+	struct adjust_plan *plan = get_plan(plans, factor[0], factor[1], factor[2], n,
+		flags | (bits == 16 ? ADJUST_PLAN_16BIT : 0));
+	if (!quiet) {
+		print_plan(plan);
+	}
+
+	adjust_plan_execute(plan, image, x, y);
+	put_plan(plans, plan);
+	*pixels = (size_t)x * y;
+
+	// ==================== Save the resulting file, in the format given by its extension
+	enum image_format format = image_format(out_name);
+	size_t samples = (size_t)x * y * n;
+	int ok;
+
+	if (bits == 16 && format == IMAGE_PNG) {
+		ok = write_png16(out_name, x, y, n, image);
+	} else if (bits == 16 && format == IMAGE_PNM) {
+		ok = write_mapped(out_name, x, y, n, 65535, image);
+	} else {
+		if (bits == 16) {
+			// The other formats are 8 bits per channel: keep the high byte of each value
+			uint16_t *wide = image;
+			unsigned char *narrow = image;
+
+			for (size_t i = 0; i < samples; i++) {
+				narrow[i] = wide[i] >> 8;
+			}
+		}
+
+		switch (format) {
+		case IMAGE_PNG:
+			ok = stbi_write_png(out_name, x, y, n, image, x * n);
+			break;
+		case IMAGE_BMP:
+			ok = stbi_write_bmp(out_name, x, y, n, image);
+			break;
+		case IMAGE_TGA:
+			ok = stbi_write_tga(out_name, x, y, n, image);
+			break;
+		case IMAGE_PNM:
+		case IMAGE_RAW:
+			ok = write_mapped(out_name, x, y, n, 255, image);
+			break;
+		default:
+			ok = write_jpg(out_name, x, y, n, image, 90, threads);
+			break;
+		}
+	}
+	image_arena_free(image);		// (stbi_image_free() is the same thing)
+
+	if (!ok) {
+		dprintf(2, "Could not write '%s'.\n", out_name);
+		return 3;
+	}
+	return 0;
+}
+
+// ==================== Batch mode (--batch)
+//
+// Adjusting thousands of small images one process at a time spends most of the time
+// starting processes, loading libraries and faulting in fresh buffers. In batch mode
+// one process adjusts every file - listed on the command line (quoted wildcards are
+// expanded here, so the list isn't limited by the shell's argument length), or in a
+// manifest - on a pool of worker threads, one file per thread at a time. Each worker
+// reuses its decoding and encoding buffers from one file to the next (see
+// image_arena.c). The outputs go to a directory, with the same names as the inputs.
+//
+// Each line of a manifest is an input file, optionally followed by its own red, green
+// and blue factors; blank lines and lines starting with # are skipped.
+
+struct batch {
+	FILE		*manifest;		// the manifest, or NULL to adjust the files in 'inputs'
+	glob_t		inputs;
+	size_t		next;			// next of 'inputs' to adjust
+	const char	*out_dir;
+	float		factor[3];		// for files without their own factors
+	int		flags, raw_x, raw_y, threads;
+
+	pthread_mutex_t	lock;			// protects everything below, and reading the manifest
+	size_t		images, failed, pixels;
+};
+
+// Split factors off the end of a manifest line, leaving the file name. Returns 0, or -1
+// if the line doesn't end with three numbers.
+static int parse_factors(char *line, float *factor) {
+	char *end = line + strlen(line);
+
+	for (int c = 2; c >= 0; c--) {
+		char *start, *number_end;
+
+		while (end > line && isspace(end[-1])) {
+			end--;
+		}
+		for (start = end; start > line && !isspace(start[-1]); start--) {
+		}
+		if (start == end || start == line) {
+			return -1;
+		}
+		factor[c] = strtof(start, &number_end);
+		if (number_end != end) {
+			return -1;
+		}
+		end = start;
+	}
+	while (end > line && isspace(end[-1])) {
+		end--;
+	}
+	*end = '\0';
+	return 0;
+}
+
+// Get the next file to adjust, and its factors. Returns 0, or -1 when there are no more.
+static int next_file(struct batch *b, char *name, size_t size, float *factor) {
+	int result = -1;
+
+	pthread_mutex_lock(&b->lock);
+	if (b->manifest == NULL) {
+		if (b->next < b->inputs.gl_pathc) {
+			snprintf(name, size, "%s", b->inputs.gl_pathv[b->next++]);
+			memcpy(factor, b->factor, sizeof(b->factor));
+			result = 0;
+		}
+	} else {
+		while (fgets(name, size, b->manifest) != NULL) {
+			name[strcspn(name, "\r\n")] = '\0';
+			if (name[strspn(name, " \t")] == '\0' || name[0] == '#') {
+				continue;
+			}
+			if (parse_factors(name, factor) != 0) {
+				memcpy(factor, b->factor, sizeof(b->factor));
+			}
+			for (int c = 0; c < 3; c++) {
+				factor[c] = MIN(2, MAX(0, factor[c]));
+			}
+			result = 0;
+			break;
+		}
+	}
+	pthread_mutex_unlock(&b->lock);
+	return result;
+}
+
+static void *batch_worker(void *arg) {
+	struct batch *b = arg;
+	char in_name[PATH_MAX], out_name[PATH_MAX + 1];
+	float factor[3];
+	struct plan_cache plans = { 0 };
+
+	image_arena_start();
+	while (next_file(b, in_name, sizeof(in_name), factor) == 0) {
+		const char *base = strrchr(in_name, '/');
+		size_t pixels = 0;
+		int result;
+
+		snprintf(out_name, sizeof(out_name), "%s/%s", b->out_dir, base != NULL ? base + 1 : in_name);
+		result = adjust_file(in_name, out_name, factor[0], factor[1], factor[2], b->flags,
+			b->raw_x, b->raw_y, b->threads, &plans, 1, &pixels);
+		image_arena_reset();
+
+		pthread_mutex_lock(&b->lock);
+		b->images++;
+		b->failed += result != 0;
+		b->pixels += pixels;
+		pthread_mutex_unlock(&b->lock);
+	}
+	free_plans(&plans);
+	image_arena_stop();
+	return NULL;
+}
+
+// Adjust every file in 'inputs' (wildcards allowed), or listed in 'manifest' ("-" for
+// stdin), into 'out_dir' on 'jobs' worker threads. Returns the exit status.
+static int batch_adjust(const char *manifest, char **inputs, int input_count, const char *out_dir,
+	float red, float green, float blue, int flags, int raw_x, int raw_y, int threads, int jobs) {
+
+	struct batch b = { NULL, { 0 }, 0, out_dir, { red, green, blue }, flags, raw_x, raw_y, threads };
+	pthread_t *workers = malloc(jobs * sizeof(pthread_t));
+	struct timespec start, end;
+	int started = 0;
+
+	if (manifest != NULL) {
+		b.manifest = strcmp(manifest, "-") == 0 ? stdin : fopen(manifest, "r");
+		if (b.manifest == NULL) {
+			dprintf(2, "Could not open the manifest '%s'.\n", manifest);
+			return 2;
+		}
+	} else {
+		for (int i = 0; i < input_count; i++) {
+			glob(inputs[i], GLOB_NOCHECK | (i > 0 ? GLOB_APPEND : 0), NULL, &b.inputs);
+		}
+	}
+	if (mkdir(out_dir, 0777) != 0 && access(out_dir, W_OK) != 0) {
+		dprintf(2, "Could not create the output directory '%s'.\n", out_dir);
+		return 3;
+	}
+	pthread_mutex_init(&b.lock, NULL);
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (; workers != NULL && started < jobs; started++) {
+		if (pthread_create(&workers[started], NULL, batch_worker, &b) != 0) {
+			break;
+		}
+	}
+	if (started == 0) {
+		batch_worker(&b);			// no threads - do it all on this one
+	}
+	for (int w = 0; w < started; w++) {
+		pthread_join(workers[w], NULL);
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	double seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+
+	printf("Batch: %zu images (%zu failed), %.1f megapixels in %.3f s on %d workers: "
+		"%.1f images/s, %.2f MP/s\n", b.images, b.failed, b.pixels / 1e6, seconds, MAX(started, 1),
+		b.images / seconds, b.pixels / 1e6 / seconds);
+
+	if (b.manifest != NULL && b.manifest != stdin) {
+		fclose(b.manifest);
+	}
+	if (manifest == NULL) {
+		globfree(&b.inputs);
+	}
+	pthread_mutex_destroy(&b.lock);
+	free(workers);
+	return b.failed != 0 ? 2 : 0;
+}
+
+// ==================== Server mode (--serve)
+//
+// For callers that adjust one image at a time with low latency, image-adjust can run as
+// a server on a Unix domain socket, so that process startup, dynamic loading, planning
+// and cold buffers are paid once rather than on every request. A pool of worker threads
+// accepts connections; each keeps its buffer arena and plan cache (see above) from one
+// request to the next. A connection carries any number of requests, one after another,
+// each a line of text:
+//
+//	FILE red green blue input output	adjust a file into another, as on the command line;
+//						the reply is "OK pixels microseconds"
+//	DATA red green blue format length	adjust the 'length' bytes of encoded image that follow
+//						the line, and send the result back encoded as 'format'
+//						(jpg, png, bmp, tga, or ppm/pgm/pam); the reply is
+//						"OK pixels microseconds length", then the data; a length
+//						over DATA_MAX is refused and the connection closed
+//	STATS					latency over the last LATENCY_SAMPLES requests:
+//						"OK requests p50_us p99_us max_us"
+//
+// or "ERROR message" if a request fails. The time is measured from the end of the
+// request (including its data) to the start of the reply, and each request is logged,
+// with its time, on stdout. File names can't contain whitespace.
+
+#define LATENCY_SAMPLES		4096
+#define REQUEST_MAX		(PATH_MAX * 2 + 128)
+#define DATA_MAX		((size_t)1 << 30)	// largest DATA request (stb_image takes an int length)
+
+static struct {
+	pthread_mutex_t	lock;
+	uint64_t	requests;
+	uint32_t	us[LATENCY_SAMPLES];	// the most recent requests' times, in a ring
+} latency = { PTHREAD_MUTEX_INITIALIZER };
+
+struct server {
+	int		listener;
+	int		flags, threads;
+};
+
+static char socket_path[sizeof(((struct sockaddr_un *)0)->sun_path)];
+
+static void stop_server(int signal) {
+	unlink(socket_path);
+	_exit(0);
+}
+
+static uint64_t elapsed_us(const struct timespec *start) {
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (now.tv_sec - start->tv_sec) * 1000000 + (now.tv_nsec - start->tv_nsec) / 1000;
+}
+
+static uint64_t record_latency(uint64_t us) {
+	uint64_t request;
+
+	pthread_mutex_lock(&latency.lock);
+	request = latency.requests++;
+	latency.us[request % LATENCY_SAMPLES] = MIN(us, UINT32_MAX);
+	pthread_mutex_unlock(&latency.lock);
+	return request;
+}
+
+static int compare_u32(const void *a, const void *b) {
+	uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+	return (x > y) - (x < y);
+}
+
+static void reply_stats(FILE *out) {
+	uint32_t us[LATENCY_SAMPLES];
+	uint64_t requests;
+	size_t count;
+
+	pthread_mutex_lock(&latency.lock);
+	requests = latency.requests;
+	count = MIN(requests, LATENCY_SAMPLES);
+	memcpy(us, latency.us, count * sizeof(uint32_t));
+	pthread_mutex_unlock(&latency.lock);
+
+	qsort(us, count, sizeof(uint32_t), compare_u32);
+	fprintf(out, "OK %llu %u %u %u\n", (unsigned long long)requests, count ? us[count / 2] : 0,
+		count ? us[(count * 99 - 1) / 100] : 0, count ? us[count - 1] : 0);
+}
+
+// stb_image_write callback: append to a stream
+static void write_stream(void *context, void *data, int size) {
+	fwrite(data, 1, size, context);
+}
+
+// Read and discard 'length' bytes, so that the next request is read from the right place
+static void skip_input(FILE *in, size_t length) {
+	char buffer[4096];
+	size_t n;
+
+	while (length > 0 && (n = fread(buffer, 1, MIN(length, sizeof(buffer)), in)) > 0) {
+		length -= n;
+	}
+}
+
+// Adjust an encoded image in memory, and encode the result as 'format' to 'out' (8 bits
+// per channel). Returns the pixels adjusted, or 0 on an error.
+static size_t adjust_encoded(const unsigned char *data, size_t length, const char *format,
+	float red, float green, float blue, int flags, struct plan_cache *plans, FILE *out) {
+
+	char name[32];
+	int x, y, n, ok;
+	unsigned char *image = stbi_load_from_memory(data, length, &x, &y, &n, 0);
+
+	if (image == NULL) {
+		return 0;
+	}
+	struct adjust_plan *plan = get_plan(plans, red, green, blue, n, flags);
+
+	adjust_plan_execute(plan, image, x, y);
+	put_plan(plans, plan);
+
+	snprintf(name, sizeof(name), "x.%s", format);
+	switch (image_format(name)) {
+	case IMAGE_PNG:
+		ok = stbi_write_png_to_func(write_stream, out, x, y, n, image, x * n);
+		break;
+	case IMAGE_BMP:
+		ok = stbi_write_bmp_to_func(write_stream, out, x, y, n, image);
+		break;
+	case IMAGE_TGA:
+		ok = stbi_write_tga_to_func(write_stream, out, x, y, n, image);
+		break;
+	case IMAGE_PNM: {
+		struct pnm_header header;
+
+		ok = output_header(name, x, y, n, 255, &header) == 0 && pnm_write_header(out, &header) == 0 &&
+			fwrite(image, (size_t)x * n, y, out) == y;
+		break;
+	}
+	case IMAGE_JPEG:
+		ok = strcasecmp(format, "jpg") == 0 || strcasecmp(format, "jpeg") == 0 ?
+			stbi_write_jpg_to_func(write_stream, out, x, y, n, image, 90) : 0;
+		break;
+	default:
+		ok = 0;
+		break;
+	}
+	image_arena_free(image);
+	return ok ? (size_t)x * y : 0;
+}
+
+// Handle the requests on one connection until the client closes it
+static void serve_connection(struct server *server, int fd, struct plan_cache *plans) {
+	FILE *in = fdopen(dup(fd), "r");
+	FILE *out = fdopen(fd, "w");
+	char request[REQUEST_MAX], input[PATH_MAX], output[PATH_MAX], format[16];
+	float red, green, blue;
+	size_t length;
+
+	while (in != NULL && out != NULL && fgets(request, sizeof(request), in) != NULL) {
+		struct timespec start;
+		size_t pixels = 0;
+		uint64_t us;
+
+		request[strcspn(request, "\r\n")] = '\0';
+
+		if (strcmp(request, "STATS") == 0) {
+			reply_stats(out);
+
+		} else if (sscanf(request, "FILE %f %f %f %4095s %4095s", &red, &green, &blue, input, output) == 5) {
+			clock_gettime(CLOCK_MONOTONIC, &start);
+			int result = adjust_file(input, output, MIN(2, MAX(0, red)), MIN(2, MAX(0, green)),
+				MIN(2, MAX(0, blue)), server->flags, 0, 0, server->threads, plans, 1, &pixels);
+			image_arena_reset();
+			us = elapsed_us(&start);
+
+			if (result != 0) {
+				fprintf(out, "ERROR could not adjust '%s' into '%s'\n", input, output);
+			} else {
+				fprintf(out, "OK %zu %llu\n", pixels, (unsigned long long)us);
+				printf("request %llu: %s -> %s, %zu pixels, %llu us\n",
+					(unsigned long long)record_latency(us), input, output, pixels,
+					(unsigned long long)us);
+			}
+
+		} else if (sscanf(request, "DATA %f %f %f %15s %zu", &red, &green, &blue, format, &length) == 5) {
+			if (length > DATA_MAX) {
+				// Too much to read, or to skip: drop the connection
+				fprintf(out, "ERROR %zu bytes of image data is more than %zu\n", length, DATA_MAX);
+				break;
+			}
+
+			unsigned char *data = image_arena_malloc(length);
+			char *encoded = NULL;
+			size_t encoded_length = 0;
+			FILE *result = open_memstream(&encoded, &encoded_length);
+
+			if (data == NULL || result == NULL) {
+				skip_input(in, length);
+				fprintf(out, "ERROR could not allocate %zu bytes for image data\n", length);
+			} else if (fread(data, 1, length, in) != length) {
+				fprintf(out, "ERROR could not read %zu bytes of image data\n", length);
+			} else {
+				clock_gettime(CLOCK_MONOTONIC, &start);
+				pixels = adjust_encoded(data, length, format, MIN(2, MAX(0, red)), MIN(2, MAX(0, green)),
+					MIN(2, MAX(0, blue)), server->flags, plans, result);
+				fclose(result);
+				result = NULL;
+				us = elapsed_us(&start);
+
+				if (pixels == 0) {
+					fprintf(out, "ERROR could not decode the image, or encode it as '%s'\n", format);
+				} else {
+					fprintf(out, "OK %zu %llu %zu\n", pixels, (unsigned long long)us, encoded_length);
+					fwrite(encoded, 1, encoded_length, out);
+					printf("request %llu: %zu bytes -> %zu bytes of %s, %zu pixels, %llu us\n",
+						(unsigned long long)record_latency(us), length, encoded_length, format,
+						pixels, (unsigned long long)us);
+				}
+			}
+			if (result != NULL) {
+				fclose(result);
+			}
+			free(encoded);
+			image_arena_free(data);
+			image_arena_reset();
+
+		} else {
+			fprintf(out, "ERROR unknown request\n");
+		}
+		if (fflush(out) != 0) {
+			break;
+		}
+	}
+	if (in != NULL) {
+		fclose(in);
+	}
+	if (out != NULL) {
+		fclose(out);
+	} else {
+		close(fd);
+	}
+}
+
+static void *server_worker(void *arg) {
+	struct server *server = arg;
+	struct plan_cache plans = { 0 };
+	int fd;
+
+	image_arena_start();
+	while ((fd = accept(server->listener, NULL, NULL)) >= 0 || errno == EINTR) {
+		if (fd >= 0) {
+			serve_connection(server, fd, &plans);
+		}
+	}
+	dprintf(2, "accept() failed - worker stopping.\n");
+	free_plans(&plans);
+	image_arena_stop();
+	return NULL;
+}
+
+// Serve requests on the socket 'path' on 'jobs' worker threads, until interrupted
+static int serve(const char *path, int flags, int threads, int jobs) {
+	struct sockaddr_un address = { AF_UNIX };
+	struct server server = { socket(AF_UNIX, SOCK_STREAM, 0), flags, threads };
+	pthread_t worker;
+
+	if (strlen(path) >= sizeof(address.sun_path)) {
+		dprintf(2, "The socket name '%s' is too long.\n", path);
+		return 1;
+	}
+	strcpy(address.sun_path, path);
+	strcpy(socket_path, path);
+	unlink(path);
+	if (server.listener < 0 || bind(server.listener, (struct sockaddr *)&address, sizeof(address)) != 0 ||
+	    listen(server.listener, SOMAXCONN) != 0) {
+		dprintf(2, "Could not listen on '%s'.\n", path);
+		return 3;
+	}
+	signal(SIGPIPE, SIG_IGN);			// a client that goes away only ends its connection
+	signal(SIGINT, stop_server);
+	signal(SIGTERM, stop_server);
+
+	// The request log is written a line at a time, since the server is stopped with _exit()
+	setvbuf(stdout, NULL, _IOLBF, 0);
+	printf("Serving on '%s' with %d workers\n", path, jobs);
+	for (int w = 1; w < jobs; w++) {
+		if (pthread_create(&worker, NULL, server_worker, &server) != 0) {
+			break;
+		}
+	}
+	server_worker(&server);
+	unlink(path);
+	return 3;
+}
+
+// ==================== Video mode (--video)
+//
+// Raw rgb24 frames are adjusted from stdin to stdout (see video_stream.c), with the factors
+// from the command line or from a keyframe schedule. stdout carries the video, so the
+// statistics go to stderr at the end.
+
+#define VIDEO_BUFFERS		6		// frames in the ring: three stages, and room to read ahead
+
+static int video_adjust(int width, int height, const char *keyframes, float red, float green, float blue,
+	int flags, double fps, int threads) {
+
+	struct video_keyframe constant = { 0, MIN(2, MAX(0, red)), MIN(2, MAX(0, green)), MIN(2, MAX(0, blue)) };
+	struct video_keyframe *keys = &constant;
+	struct video_stats stats;
+	int count = 1;
+
+	if (keyframes != NULL && (count = video_read_keyframes(keyframes, &keys)) < 0) {
+		return 1;
+	}
+	signal(SIGPIPE, SIG_IGN);			// report a consumer that goes away, with the stats
+
+	int failed = video_stream_adjust(0, 1, width, height, keys, count, flags, fps, VIDEO_BUFFERS, &stats);
+
+	dprintf(2, "%llu frames of %dx%d in %.3f s: %.2f fps, %.1f MB/s, %d threads\n", (unsigned long long)stats.frames,
+		width, height, stats.seconds, stats.seconds > 0 ? stats.frames / stats.seconds : 0,
+		stats.seconds > 0 ? stats.frames * (double)width * height * 3 / stats.seconds / 1e6 : 0, threads);
+	dprintf(2, "adjust: %.3f ms/frame mean, %.3f ms max; waited %.0f ms for input, reader waited %.0f ms for a buffer\n",
+		stats.adjusted ? stats.adjust_sum_ms / stats.adjusted : 0, stats.adjust_max_ms,
+		stats.input_wait_ms, stats.buffer_wait_ms);
+	dprintf(2, "%llu read() and %llu write() calls", (unsigned long long)stats.reads,
+		(unsigned long long)stats.writes);
+	if (fps > 0) {
+		dprintf(2, "; %llu of %llu frames late for %.3f fps", (unsigned long long)stats.late,
+			(unsigned long long)stats.frames, fps);
+	}
+	dprintf(2, "\n");
+	if (stats.discarded > 0) {
+		dprintf(2, "The input ended with a partial frame (%zu bytes), which was dropped.\n", stats.discarded);
+	}
+	if (failed) {
+		dprintf(2, "Reading or writing the video failed.\n");
+	}
+	if (keys != &constant) {
+		free(keys);
+	}
+	return failed ? 3 : 0;
+}
+
+static void usage(char *name) {
+	dprintf(2, "\nUsage: %s [--impl=N|name|auto] [--threads=N] [--stream[=rows]] [--raw-size=WxH] [--ops=list] input red green blue output\n"
+		"   or: %s --auto[=grayworld|stretch] [--impl=...] [--threads=N] [--raw-size=WxH] [--ops=list] input [red green blue] output\n"
+		"   or: %s --batch=outdir [--jobs=N] [--manifest=file|-] [--impl=...] [--raw-size=WxH] [--ops=list] [--auto[=...]] red green blue [input ...]\n"
+		"   or: %s --serve=path [--jobs=N] [--impl=...] [--ops=list] [--auto[=...]]\n"
+		"   or: %s --video=WxH [--keyframes=file] [--fps=N] [--impl=...] [--threads=N] [red green blue]\n"
+		"Where red/green/blue are in the range 0.0-2.0\n", name, name, name, name, name);
+	dprintf(2, "and --threads=0 uses one thread per online CPU (default: 1)\n");
+	dprintf(2, "--stream processes a binary PGM, PPM or PAM file a strip of rows at a time (default 16),\n"
+		"writing the output in the same format\n");
+	dprintf(2, "The output format follows its extension: .jpg (the default), .png, .bmp, .tga, .pgm/.ppm/.pam/.pnm,\n"
+		"or raw .gray/.rgb/.rgba. Raw and Netpbm input files are mapped into memory, and adjusted in place\n"
+		"when the output is the same file; raw input needs --raw-size. 16-bit input (e.g. 16-bit PNG, PSD,\n"
+		"PPM) is processed at 16 bits, and written at 16 bits to .png and Netpbm files\n");
+	dprintf(2, "--batch adjusts every input (quoted wildcards are expanded), or every file listed in the manifest\n"
+		"(one per line, optionally followed by its own red green blue), into outdir under the same names,\n"
+		"on --jobs worker threads (default: one per online CPU), and reports images/s and MP/s\n");
+	dprintf(2, "--serve runs a server on the Unix socket 'path', adjusting images on request on --jobs worker\n"
+		"threads (see scripts/adjust_client for the protocol)\n");
+	dprintf(2, "--video adjusts raw rgb24 frames of WxH from stdin to stdout, with red green blue or with the\n"
+		"factors interpolated between keyframes (lines of 'frame red green blue'); --fps counts the frames\n"
+		"that fall behind that rate\n");
+	dprintf(2, "--ops applies a list of operations after the factors, in the same pass over each 8-bit RGB\n"
+		"image: scale=v[:v:v], offset=v[:v:v], matrix=v:v:v:v:v:v:v:v:v, saturation=v, ycbcr, rgb, gamma=v,\n"
+		"contrast=v, clamp=low:high, separated by commas, e.g. --ops=contrast=1.2,gamma=2.2,clamp=16:235\n"
+		"(other images get the factors alone)\n");
+	dprintf(2, "--auto balances each image from its own statistics, then applies red green blue on top: grayworld\n"
+		"(the default) makes the channel means equal, stretch scales each channel so that all but its\n"
+		"brightest 0.5%% of samples fit in range\n");
+	dprintf(2, "\nAvailable implementations:\n");
+	for (int i = 0; i < adjust_implementation_count; i++) {
+		dprintf(2, "  %2d  %-18s %s%s\n", adjust_implementations[i].number, adjust_implementations[i].name,
+			adjust_implementations[i].description,
+			adjust_implementations[i].supported() ? "" : " (not supported on this CPU)");
+	}
+}
+
+int main(int argc, char *argv[]) {
+
+	// ==================== Process options
+	char *name = argv[0];
+	int argi = 1;
+	const char *impl = "auto";
+	int threads = 1;
+	int stream_rows = 0;
+	int raw_x = 0, raw_y = 0;
+	const char *batch = NULL, *manifest = NULL, *socket_name = NULL, *keyframes = NULL;
+	int jobs = 0;
+	int video_x = 0, video_y = 0;
+	double fps = 0;
+
+	for (; argi < argc && strncmp(argv[argi], "--", 2) == 0; argi++) {
+		if (strncmp(argv[argi], "--impl=", 7) == 0) {
+			impl = argv[argi] + 7;
+		} else if (strncmp(argv[argi], "--threads=", 10) == 0) {
+			threads = atoi(argv[argi] + 10);
+		} else if (strcmp(argv[argi], "--stream") == 0) {
+			stream_rows = 16;
+		} else if (strncmp(argv[argi], "--stream=", 9) == 0) {
+			stream_rows = MAX(1, atoi(argv[argi] + 9));
+		} else if (strncmp(argv[argi], "--batch=", 8) == 0) {
+			batch = argv[argi] + 8;
+		} else if (strncmp(argv[argi], "--serve=", 8) == 0) {
+			socket_name = argv[argi] + 8;
+		} else if (strncmp(argv[argi], "--jobs=", 7) == 0) {
+			jobs = atoi(argv[argi] + 7);
+		} else if (strncmp(argv[argi], "--manifest=", 11) == 0) {
+			manifest = argv[argi] + 11;
+		} else if (strncmp(argv[argi], "--video=", 8) == 0) {
+			if (sscanf(argv[argi] + 8, "%dx%d", &video_x, &video_y) != 2 || video_x <= 0 || video_y <= 0) {
+				usage(name);
+				return 1;
+			}
+		} else if (strncmp(argv[argi], "--fps=", 6) == 0) {
+			fps = atof(argv[argi] + 6);
+		} else if (strncmp(argv[argi], "--ops=", 6) == 0) {
+			plan_ops = argv[argi] + 6;
+		} else if (strcmp(argv[argi], "--auto") == 0 || strcmp(argv[argi], "--auto=grayworld") == 0) {
+			auto_method = ADJUST_AUTO_GRAY_WORLD;
+		} else if (strcmp(argv[argi], "--auto=stretch") == 0) {
+			auto_method = ADJUST_AUTO_STRETCH;
+		} else if (strncmp(argv[argi], "--keyframes=", 12) == 0) {
+			keyframes = argv[argi] + 12;
+		} else if (strncmp(argv[argi], "--raw-size=", 11) == 0) {
+			if (sscanf(argv[argi] + 11, "%dx%d", &raw_x, &raw_y) != 2) {
+				usage(name);
+				return 1;
+			}
+		} else {
+			usage(name);
+			return 1;
+		}
+	}
+	argv += argi - 1;		// shift so the positional arguments are argv[1] .. argv[5]
+	argc -= argi - 1;
+
+	if (adjust_select_implementation(impl) != 0) {
+		dprintf(2, "Implementation '%s' is unknown or not supported on this CPU.\n", impl);
+		usage(name);
+		return 1;
+	}
+
+	// In batch and server modes the images are adjusted in parallel, so each one gets a
+	// single thread unless there is only one worker
+	int parallel = batch != NULL || socket_name != NULL;
+
+	if (parallel && jobs <= 0) {
+		jobs = sysconf(_SC_NPROCESSORS_ONLN);
+	}
+	threads = adjust_set_threads(parallel && jobs > 1 ? 1 : threads);
+
+	// If an implementation was asked for, use it even if a fast path would do
+	int flags = strcmp(impl, "auto") == 0 ? 0 : ADJUST_PLAN_NO_FASTPATH;
+
+	// Check the operation list now rather than for each image
+	if (plan_ops != NULL) {
+		struct adjust_ops *ops = adjust_ops_create();
+		struct adjust_plan *plan = NULL;
+
+		if (ops != NULL && adjust_ops_parse(ops, plan_ops) == 0) {
+			plan = adjust_ops_plan(ops, flags);
+		}
+		adjust_ops_destroy(ops);
+		if (plan == NULL || video_x > 0) {
+			dprintf(2, plan == NULL ? "Operation list '%s' is not valid, or can't be done in one pass.\n" :
+				"--ops can't be used with --video.\n", plan_ops);
+			usage(name);
+			return 1;
+		}
+		adjust_plan_destroy(plan);
+	}
+
+	// Automatic white balance needs the whole image before adjusting any of it
+	if (auto_method >= 0 && (stream_rows > 0 || video_x > 0)) {
+		dprintf(2, "--auto can't be used with --stream or --video.\n");
+		usage(name);
+		return 1;
+	}
+
+	if (socket_name != NULL) {
+		if (argc != 1) {
+			usage(name);
+			return 1;
+		}
+		return serve(socket_name, flags, threads, jobs);
+	}
+	if (video_x > 0) {
+		if (argc != 4 && !(argc == 1 && keyframes != NULL)) {
+			usage(name);
+			return 1;
+		}
+		return video_adjust(video_x, video_y, keyframes, argc == 4 ? strtof(argv[1], NULL) : 1,
+			argc == 4 ? strtof(argv[2], NULL) : 1, argc == 4 ? strtof(argv[3], NULL) : 1,
+			flags, fps, threads);
+	}
+
+	// ==================== Check arg count
+	// (with --auto, a single file's factors may be left out)
+	if (batch != NULL ? argc < 4 || (argc == 4 && manifest == NULL) : argc != 6 && !(argc == 3 && auto_method >= 0)) {
+		usage(name);
+		return 1;
+	}
+
+	// Get arguments 2, 3, and 4 (1, 2 and 3 in batch mode); each should be a number in the range 0.0 .. 2.0
 	// Yes this is ugly and should be improved, this is a quick & dirty test program :-)
-	float redarg   = MIN(2, MAX(0, strtof(argv[2],NULL)));
-	float greenarg = MIN(2, MAX(0, strtof(argv[3],NULL)));
-	float bluearg  = MIN(2, MAX(0, strtof(argv[4],NULL)));
-	
+	char **factors = batch != NULL ? argv : argv + 1;
+	char *out_name = argv[argc - 1];
+	float redarg   = argc == 3 ? 1 : MIN(2, MAX(0, strtof(factors[1],NULL)));
+	float greenarg = argc == 3 ? 1 : MIN(2, MAX(0, strtof(factors[2],NULL)));
+	float bluearg  = argc == 3 ? 1 : MIN(2, MAX(0, strtof(factors[3],NULL)));
+
 	printf("Adjustments:\tred: %8.6f   green: %8.6f   blue: %8.6f\n", redarg, greenarg, bluearg);
-	
-	adjust_channels(image, x, y, redarg, greenarg, bluearg);
+	if (threads > 1) {
+		printf("Using %d threads\n", threads);
+	}
+
+	if (batch != NULL) {
+		return batch_adjust(manifest, argv + 4, argc - 4, batch, redarg, greenarg, bluearg, flags,
+			raw_x, raw_y, threads, jobs);
+	}
+	if (stream_rows > 0) {
+		return stream_image(argv[1], out_name, redarg, greenarg, bluearg, flags, stream_rows);
+	}
+	if (image_raw_channels(argv[1]) != 0 && (raw_x <= 0 || raw_y <= 0)) {
+		dprintf(2, "The size of a raw input file must be given with --raw-size=WxH.\n");
+		return 1;
+	}
 
-	// ==================== Save the resulting file (jpg) (arg 5)
-	stbi_write_jpg(argv[5], x, y, n, image, 90);
+	size_t pixels;
+	int result = adjust_file(argv[1], out_name, redarg, greenarg, bluearg, flags, raw_x, raw_y, threads, NULL, 0,
+		&pixels);
+
+	if (result == 2) {
+		usage(name);
+	}
+	return result;
 }
 
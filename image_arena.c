@@ -0,0 +1,139 @@
+/*
+
+        image_arena :: reuse decoding and encoding buffers from one image to the next
+
+        Decoding a JPEG with stb_image makes a handful of allocations - the
+        Huffman tables and component buffers, the decoded image - and
+        encoding one makes a few more; for a small image, the malloc() and
+        free() calls, and the page faults on freshly mapped memory, cost
+        as much as the adjustment. In batch mode each worker thread gives
+        stb_image and stb_image_write (through STBI_MALLOC, STBIW_MALLOC
+        etc.) a bump allocator over a buffer that it keeps for its whole
+        run: an allocation is a pointer increment, a free does nothing,
+        and the whole arena is reset between images.
+
+        The arena starts at 2MB (one huge page, see adjust_alloc()); an
+        allocation that doesn't fit falls back to malloc(), and the next
+        reset grows the arena to cover everything the image needed, so
+        after the first few images every allocation comes from the arena.
+
+        Copyright (C)2022 Seneca College of Applied Arts and Technology
+        Written by Chris Tyler
+        Distributed under the terms of the GNU GPL v2
+
+*/
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/param.h>
+
+#include "adjust_channels.h"
+#include "image_arena.h"
+
+#define ARENA_START	(2 * 1024 * 1024)	// first arena size
+#define ALIGN		16			// alignment of every allocation (also the header size)
+
+struct arena {
+	unsigned char	*base;
+	size_t		size;
+	size_t		used;
+	size_t		wanted;		// bytes asked for since the last reset, in or out of the arena
+};
+
+static _Thread_local struct arena arena;
+
+// Each allocation is preceded by a header holding its size, for realloc
+static size_t *header(void *p) {
+	return (size_t *)((unsigned char *)p - ALIGN);
+}
+
+static int in_arena(void *p) {
+	return arena.base != NULL && (unsigned char *)p >= arena.base && (unsigned char *)p < arena.base + arena.size;
+}
+
+int image_arena_start(void) {
+	arena.base = adjust_alloc(ARENA_START, 0);
+	arena.size = arena.base != NULL ? ARENA_START : 0;
+	arena.used = arena.wanted = 0;
+	return arena.base != NULL ? 0 : -1;
+}
+
+void image_arena_reset(void) {
+	if (arena.base != NULL && arena.wanted > arena.size) {
+		size_t size = arena.wanted + arena.wanted / 4;
+		unsigned char *base = adjust_alloc(size, 0);
+
+		if (base != NULL) {
+			adjust_free(arena.base);
+			arena.base = base;
+			arena.size = size;
+		}
+	}
+	arena.used = arena.wanted = 0;
+}
+
+void image_arena_stop(void) {
+	adjust_free(arena.base);
+	memset(&arena, 0, sizeof(arena));
+}
+
+void *image_arena_malloc(size_t bytes) {
+	if (bytes > SIZE_MAX - 2 * ALIGN) {
+		return NULL;	// the rounded-up length would wrap
+	}
+
+	size_t length = ALIGN + (bytes + ALIGN - 1) / ALIGN * ALIGN;
+
+	if (arena.base == NULL) {
+		return malloc(bytes);
+	}
+	arena.wanted += length;
+	if (arena.used + length > arena.size) {
+		return malloc(bytes);
+	}
+
+	unsigned char *p = arena.base + arena.used + ALIGN;
+
+	arena.used += length;
+	*header(p) = bytes;
+	return p;
+}
+
+void *image_arena_realloc(void *p, size_t bytes) {
+	if (p == NULL) {
+		return image_arena_malloc(bytes);
+	}
+	if (!in_arena(p)) {
+		return realloc(p, bytes);
+	}
+	if (bytes > SIZE_MAX - 2 * ALIGN) {
+		return NULL;
+	}
+
+	size_t old = *header(p);
+	size_t old_length = ALIGN + (old + ALIGN - 1) / ALIGN * ALIGN;
+	size_t length = ALIGN + (bytes + ALIGN - 1) / ALIGN * ALIGN;
+
+	// The most recent allocation can grow (or shrink) where it is
+	if ((unsigned char *)p + old_length - ALIGN == arena.base + arena.used &&
+	    arena.used - old_length + length <= arena.size) {
+		arena.used = arena.used - old_length + length;
+		arena.wanted = arena.wanted - old_length + length;
+		*header(p) = bytes;
+		return p;
+	}
+
+	void *q = image_arena_malloc(bytes);
+
+	if (q != NULL) {
+		memcpy(q, p, MIN(old, bytes));
+	}
+	return q;
+}
+
+void image_arena_free(void *p) {
+	if (!in_arena(p)) {
+		free(p);
+	}
+}
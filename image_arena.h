@@ -0,0 +1,26 @@
+// image_arena.h
+
+#ifndef IMAGE_ARENA_H
+#define IMAGE_ARENA_H
+
+#include <stddef.h>
+
+// A per-thread arena for decoding and encoding buffers (see image_arena.c). Until
+// image_arena_start() is called on a thread, the functions below are just malloc(),
+// realloc() and free().
+
+// Give this thread an arena. Returns 0, or -1 if it couldn't be allocated.
+int image_arena_start(void);
+
+// Free everything allocated in this thread's arena since the last reset, ready for the
+// next image - and if the last image needed more than the arena holds, grow it to fit.
+void image_arena_reset(void);
+
+// Release this thread's arena
+void image_arena_stop(void);
+
+void *image_arena_malloc(size_t bytes);
+void *image_arena_realloc(void *p, size_t bytes);
+void image_arena_free(void *p);
+
+#endif
@@ -0,0 +1,183 @@
+/*
+
+        image_map :: map raw and Netpbm image files straight into memory
+
+        Decoding a JPEG or PNG costs far more than adjusting it. For
+        intermediate files that don't need compression, a raw or Netpbm
+        (PGM/PPM/PAM) file holds the pixels exactly as they are laid out in
+        memory, after a short header - so the file can simply be mapped with
+        mmap() and adjusted where it is, with no decoding, encoding, or
+        copying through a heap buffer.
+
+        The mappings are made with MAP_POPULATE, so the whole file is read
+        (or for a new file, allocated) up front instead of page fault by page
+        fault, and are advised as MADV_SEQUENTIAL (read ahead aggressively,
+        drop pages behind) and MADV_HUGEPAGE (where the filesystem can use
+        transparent huge pages, fewer TLB misses). Changes are written back
+        by the kernel when the file is unmapped.
+
+        Copyright (C)2022 Seneca College of Applied Arts and Technology
+        Written by Chris Tyler
+        Distributed under the terms of the GNU GPL v2
+
+*/
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/param.h>
+#include <sys/stat.h>
+
+#include "image_map.h"
+#include "pnm_stream.h"
+
+#define HEADER_MAX	1024		// longest Netpbm header we look for
+
+// ==================== Formats
+
+static const struct {
+	const char		*extension;
+	enum image_format	format;
+	int			raw_channels;
+} extensions[] = {
+	{ ".png",  IMAGE_PNG },
+	{ ".bmp",  IMAGE_BMP },
+	{ ".tga",  IMAGE_TGA },
+	{ ".pgm",  IMAGE_PNM },
+	{ ".ppm",  IMAGE_PNM },
+	{ ".pam",  IMAGE_PNM },
+	{ ".pnm",  IMAGE_PNM },
+	{ ".gray", IMAGE_RAW, 1 },
+	{ ".grey", IMAGE_RAW, 1 },
+	{ ".rgb",  IMAGE_RAW, 3 },
+	{ ".rgba", IMAGE_RAW, 4 },
+};
+
+static int find_extension(const char *name) {
+	const char *dot = strrchr(name, '.');
+
+	for (int e = 0; dot != NULL && e < sizeof(extensions) / sizeof(extensions[0]); e++) {
+		if (strcasecmp(dot, extensions[e].extension) == 0) {
+			return e;
+		}
+	}
+	return -1;
+}
+
+enum image_format image_format(const char *name) {
+	int e = find_extension(name);
+
+	return e >= 0 ? extensions[e].format : IMAGE_JPEG;
+}
+
+int image_raw_channels(const char *name) {
+	int e = find_extension(name);
+
+	return e >= 0 ? extensions[e].raw_channels : 0;
+}
+
+// ==================== Mapping
+
+static int map_file(int fd, size_t length, int prot, struct image_map *map) {
+	map->base = mmap(NULL, length, prot, MAP_SHARED | MAP_POPULATE, fd, 0);
+	if (map->base == MAP_FAILED) {
+		return -1;
+	}
+	map->length = length;
+
+	// Advice only - ignore failures (e.g. no huge page support for this filesystem)
+	madvise(map->base, length, MADV_SEQUENTIAL);
+#ifdef MADV_HUGEPAGE
+	madvise(map->base, length, MADV_HUGEPAGE);
+#endif
+	return 0;
+}
+
+static size_t pixel_bytes(const struct pnm_header *header) {
+	return (size_t)header->width * header->height * pnm_bytes_per_pixel(header);
+}
+
+int image_map_input(const char *name, const struct pnm_header *raw, int writable, struct image_map *map) {
+	int fd = open(name, writable ? O_RDWR : O_RDONLY);
+	struct stat st;
+	size_t offset = 0;
+	int result;
+
+	if (fd < 0) {
+		return -1;
+	}
+	result = fstat(fd, &st) != 0 || st.st_size == 0 ||
+		map_file(fd, st.st_size, PROT_READ | (writable ? PROT_WRITE : 0), map) != 0;
+	close(fd);				// the mapping keeps the file open
+	if (result != 0) {
+		return -1;
+	}
+
+	if (raw != NULL) {
+		map->header = *raw;
+	} else {
+		// Parse the header in place, through a read-only stream on the mapping
+		FILE *f = fmemopen(map->base, MIN(map->length, HEADER_MAX), "r");
+
+		if (f == NULL || pnm_read_header(f, &map->header) != 0) {
+			if (f != NULL) {
+				fclose(f);
+			}
+			image_unmap(map);
+			return -1;
+		}
+		offset = ftell(f);
+		fclose(f);
+	}
+
+	if (map->length < offset + pixel_bytes(&map->header)) {
+		image_unmap(map);
+		return -1;
+	}
+	map->pixels = map->base + offset;
+	return 0;
+}
+
+int image_map_output(const char *name, const struct pnm_header *header, struct image_map *map) {
+	char text[HEADER_MAX];
+	size_t offset = 0;
+
+	if (header->format != 0) {
+		FILE *f = fmemopen(text, sizeof(text), "w");
+		int result;
+
+		if (f == NULL) {
+			return -1;
+		}
+		result = pnm_write_header(f, header);
+		offset = ftell(f);
+		fclose(f);
+		if (result != 0) {
+			return -1;
+		}
+	}
+
+	int fd = open(name, O_RDWR | O_CREAT | O_TRUNC, 0666);
+	size_t length = offset + pixel_bytes(header);
+	int result;
+
+	if (fd < 0) {
+		return -1;
+	}
+	result = ftruncate(fd, length) != 0 || map_file(fd, length, PROT_READ | PROT_WRITE, map) != 0;
+	close(fd);
+	if (result != 0) {
+		return -1;
+	}
+	memcpy(map->base, text, offset);
+	map->header = *header;
+	map->pixels = map->base + offset;
+	return 0;
+}
+
+int image_unmap(struct image_map *map) {
+	return munmap(map->base, map->length);
+}
@@ -0,0 +1,45 @@
+// image_map.h
+
+#ifndef IMAGE_MAP_H
+#define IMAGE_MAP_H
+
+#include <stddef.h>
+
+#include "pnm_stream.h"
+
+// File formats, chosen by the filename's extension (see image_format())
+enum image_format {
+	IMAGE_JPEG,			// .jpg, .jpeg, and anything not listed below
+	IMAGE_PNG,			// .png
+	IMAGE_BMP,			// .bmp
+	IMAGE_TGA,			// .tga
+	IMAGE_PNM,			// .pgm, .ppm, .pam, .pnm
+	IMAGE_RAW,			// .gray/.grey (1 channel), .rgb (3), .rgba (4) - 8-bit, no header
+};
+
+enum image_format image_format(const char *name);
+
+// Channels in a raw file with this name (0 if it isn't IMAGE_RAW)
+int image_raw_channels(const char *name);
+
+// A file mapped into memory: a Netpbm or raw header, and the pixel data in the mapping
+struct image_map {
+	unsigned char		*base;		// start of the mapping
+	size_t			length;
+	unsigned char		*pixels;	// start of the pixel data
+	struct pnm_header	header;		// format 0 for raw files
+};
+
+// Map an existing Netpbm file (or a raw file, if 'raw' gives its size and channels, with
+// format 0). 'writable' maps it read-write for adjusting in place. Returns 0, or -1 if the
+// file can't be opened or isn't a supported Netpbm file.
+int image_map_input(const char *name, const struct pnm_header *raw, int writable, struct image_map *map);
+
+// Create a file for an image described by 'header' (format 0 for raw), with the header
+// written and the space for the pixel data mapped. Returns 0, or -1 on an error.
+int image_map_output(const char *name, const struct pnm_header *header, struct image_map *map);
+
+// Unmap, writing back any changes. Returns 0, or -1 on an error.
+int image_unmap(struct image_map *map);
+
+#endif
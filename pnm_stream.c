@@ -0,0 +1,316 @@
+/*
+
+        pnm_stream :: adjust an image strip by strip, without loading all of it
+
+        stb_image decodes a whole file at once, so the memory needed grows with
+        the image: a gigapixel panorama needs gigabytes for the decoded pixels
+        alone. The binary Netpbm formats (PGM, PPM and PAM) are just a header
+        followed by the raw rows, so they can be read, adjusted and written a
+        strip of rows at a time instead.
+
+        Three stages run at once, each on its own thread, and pass strips
+        around a ring of buffers:
+
+                reader  (worker thread)         fread() a strip into an empty buffer
+                adjust  (calling thread)        adjust_plan_execute() on the strip,
+                                                while it is still in cache
+                writer  (worker thread)         fwrite() the adjusted strip, and hand
+                                                the buffer back to the reader
+
+        With one buffer per stage, reading strip n+1 and writing strip n-1
+        overlap with adjusting strip n, and the memory used is three strips
+        however large the image is.
+
+        16-bit samples (maxval > 255) are stored big-endian in the file; the
+        reader and writer convert them to and from native byte order.
+
+        Copyright (C)2022 Seneca College of Applied Arts and Technology
+        Written by Chris Tyler
+        Distributed under the terms of the GNU GPL v2
+
+*/
+
+#include <ctype.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/param.h>
+
+#include "adjust_channels.h"
+#include "pnm_stream.h"
+
+// ==================== Headers
+
+// Read an unsigned decimal number, skipping whitespace and # comments before it
+static int read_number(FILE *f) {
+	int c, value = 0;
+
+	while ((c = getc(f)) == '#' || isspace(c)) {
+		if (c == '#') {
+			while ((c = getc(f)) != '\n' && c != EOF) {
+			}
+		}
+	}
+	if (!isdigit(c)) {
+		return -1;
+	}
+	for (; isdigit(c); c = getc(f)) {
+		value = value * 10 + (c - '0');
+		if (value > 1000000000) {
+			return -1;
+		}
+	}
+	return isspace(c) ? value : -1;		// exactly one whitespace character ends the header
+}
+
+// PAM headers are lines of "KEYWORD value", ending with "ENDHDR"
+static int read_pam_header(FILE *f, struct pnm_header *header) {
+	char line[256], keyword[16];
+	int value;
+
+	header->width = header->height = header->channels = header->maxval = -1;
+	while (fgets(line, sizeof(line), f) != NULL) {
+		if (line[0] == '#' || sscanf(line, "%15s", keyword) != 1) {
+			continue;
+		}
+		if (strcmp(keyword, "ENDHDR") == 0) {
+			return 0;
+		}
+		if (strcmp(keyword, "TUPLTYPE") == 0) {
+			continue;			// implied by the depth
+		}
+		if (sscanf(line, "%15s %d", keyword, &value) != 2) {
+			return -1;
+		}
+		if (strcmp(keyword, "WIDTH") == 0) {
+			header->width = value;
+		} else if (strcmp(keyword, "HEIGHT") == 0) {
+			header->height = value;
+		} else if (strcmp(keyword, "DEPTH") == 0) {
+			header->channels = value;
+		} else if (strcmp(keyword, "MAXVAL") == 0) {
+			header->maxval = value;
+		}
+	}
+	return -1;
+}
+
+int pnm_read_header(FILE *f, struct pnm_header *header) {
+	if (getc(f) != 'P') {
+		return -1;
+	}
+	header->format = getc(f) - '0';
+
+	switch (header->format) {
+	case 5:
+	case 6:
+		header->channels = header->format == 5 ? 1 : 3;
+		header->width = read_number(f);
+		header->height = read_number(f);
+		header->maxval = read_number(f);
+		break;
+
+	case 7:
+		if (getc(f) != '\n' || read_pam_header(f, header) != 0) {
+			return -1;
+		}
+		break;
+
+	default:
+		return -1;
+	}
+
+	if (header->width <= 0 || header->height <= 0 || header->channels < 1 || header->channels > 4 ||
+	    header->maxval < 1 || header->maxval > 65535) {
+		return -1;
+	}
+	return 0;
+}
+
+int pnm_write_header(FILE *f, const struct pnm_header *header) {
+	static const char *tupltype[] = { "", "GRAYSCALE", "GRAYSCALE_ALPHA", "RGB", "RGB_ALPHA" };
+	int result;
+
+	if (header->format == 7) {
+		result = fprintf(f, "P7\nWIDTH %d\nHEIGHT %d\nDEPTH %d\nMAXVAL %d\nTUPLTYPE %s\nENDHDR\n",
+			header->width, header->height, header->channels, header->maxval,
+			tupltype[header->channels]);
+	} else {
+		result = fprintf(f, "P%d\n%d %d\n%d\n", header->format, header->width, header->height,
+			header->maxval);
+	}
+	return result < 0 ? -1 : 0;
+}
+
+int pnm_bytes_per_pixel(const struct pnm_header *header) {
+	return header->channels * (header->maxval > 255 ? 2 : 1);
+}
+
+// ==================== Streaming
+
+#define STREAM_BUFFERS		3		// one per stage
+
+enum { EMPTY, READ, ADJUSTED };			// state of a buffer: the stage that last finished with it
+
+struct stream {
+	FILE			*in, *out;
+	const struct pnm_header	*header;
+	int			rows;		// rows per strip
+	int			strips;
+	size_t			row_bytes;
+
+	pthread_mutex_t		lock;
+	pthread_cond_t		changed;	// broadcast whenever a buffer changes state
+	int			failed;		// set by any stage on an error, to stop the others
+
+	struct {
+		unsigned char	*data;
+		int		state;
+	} buffer[STREAM_BUFFERS];
+};
+
+// Rows in strip 's' (the last strip may be short)
+static int strip_rows(struct stream *s, int strip) {
+	return MIN(s->rows, s->header->height - strip * s->rows);
+}
+
+// Wait until strip's buffer is in 'state' (returns 0), or until a stage has failed (returns -1)
+static int wait_for(struct stream *s, int strip, int state) {
+	int result;
+
+	pthread_mutex_lock(&s->lock);
+	while (!s->failed && s->buffer[strip % STREAM_BUFFERS].state != state) {
+		pthread_cond_wait(&s->changed, &s->lock);
+	}
+	result = s->failed ? -1 : 0;
+	pthread_mutex_unlock(&s->lock);
+	return result;
+}
+
+// Put strip's buffer into 'state', or flag a failure if 'ok' is zero
+static void hand_on(struct stream *s, int strip, int state, int ok) {
+	pthread_mutex_lock(&s->lock);
+	if (ok) {
+		s->buffer[strip % STREAM_BUFFERS].state = state;
+	} else {
+		s->failed = 1;
+	}
+	pthread_cond_broadcast(&s->changed);
+	pthread_mutex_unlock(&s->lock);
+}
+
+void pnm_swap16(unsigned char *data, size_t bytes) {
+	for (size_t i = 0; i < bytes; i += 2) {
+		unsigned char t = data[i];
+		data[i] = data[i + 1];
+		data[i + 1] = t;
+	}
+}
+
+void pnm_clamp(unsigned char *data, size_t bytes, int maxval) {
+	if (maxval > 255) {
+		uint16_t *wide = (uint16_t *)data;
+		for (size_t i = 0; i < bytes / 2; i++) {
+			wide[i] = MIN(wide[i], maxval);
+		}
+	} else {
+		for (size_t i = 0; i < bytes; i++) {
+			data[i] = MIN(data[i], maxval);
+		}
+	}
+}
+
+static void *reader(void *arg) {
+	struct stream *s = arg;
+
+	for (int strip = 0; strip < s->strips; strip++) {
+		if (wait_for(s, strip, EMPTY) != 0) {
+			break;
+		}
+		unsigned char *data = s->buffer[strip % STREAM_BUFFERS].data;
+		size_t bytes = s->row_bytes * strip_rows(s, strip);
+		int ok = fread(data, 1, bytes, s->in) == bytes;
+
+		if (ok && s->header->maxval > 255) {
+			pnm_swap16(data, bytes);
+		}
+		hand_on(s, strip, READ, ok);
+	}
+	return NULL;
+}
+
+static void *writer(void *arg) {
+	struct stream *s = arg;
+
+	for (int strip = 0; strip < s->strips; strip++) {
+		if (wait_for(s, strip, ADJUSTED) != 0) {
+			break;
+		}
+		unsigned char *data = s->buffer[strip % STREAM_BUFFERS].data;
+		size_t bytes = s->row_bytes * strip_rows(s, strip);
+
+		if (s->header->maxval != 255 && s->header->maxval != 65535) {
+			pnm_clamp(data, bytes, s->header->maxval);
+		}
+		if (s->header->maxval > 255) {
+			pnm_swap16(data, bytes);
+		}
+		hand_on(s, strip, EMPTY, fwrite(data, 1, bytes, s->out) == bytes);
+	}
+	return NULL;
+}
+
+int pnm_stream_adjust(FILE *in, FILE *out, const struct pnm_header *header,
+	const struct adjust_plan *plan, int rows) {
+
+	struct stream s = { in, out, header, MAX(rows, 1) };
+	pthread_t read_thread, write_thread;
+	int failed;
+
+	s.strips = (header->height + s.rows - 1) / s.rows;
+	s.row_bytes = (size_t)header->width * pnm_bytes_per_pixel(header);
+	pthread_mutex_init(&s.lock, NULL);
+	pthread_cond_init(&s.changed, NULL);
+
+	for (int b = 0; b < STREAM_BUFFERS; b++) {
+		s.buffer[b].data = malloc(s.row_bytes * s.rows);
+		s.buffer[b].state = EMPTY;
+		if (s.buffer[b].data == NULL) {
+			s.failed = 1;
+		}
+	}
+	if (!s.failed) {
+		int reading = pthread_create(&read_thread, NULL, reader, &s) == 0;
+		int writing = reading && pthread_create(&write_thread, NULL, writer, &s) == 0;
+
+		// A stage that couldn't be started fails the stream (and stops the other)
+		if (!writing) {
+			hand_on(&s, 0, EMPTY, 0);
+		}
+		for (int strip = 0; strip < s.strips; strip++) {
+			if (wait_for(&s, strip, READ) != 0) {
+				break;
+			}
+			adjust_plan_execute(plan, s.buffer[strip % STREAM_BUFFERS].data, header->width,
+				strip_rows(&s, strip));
+			hand_on(&s, strip, ADJUSTED, 1);
+		}
+
+		if (reading) {
+			pthread_join(read_thread, NULL);
+		}
+		if (writing) {
+			pthread_join(write_thread, NULL);
+		}
+	}
+
+	failed = s.failed;
+	for (int b = 0; b < STREAM_BUFFERS; b++) {
+		free(s.buffer[b].data);
+	}
+	pthread_cond_destroy(&s.changed);
+	pthread_mutex_destroy(&s.lock);
+	return failed || fflush(out) != 0 ? -1 : 0;
+}
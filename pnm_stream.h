@@ -0,0 +1,42 @@
+// pnm_stream.h
+
+#ifndef PNM_STREAM_H
+#define PNM_STREAM_H
+
+#include <stdio.h>
+
+#include "adjust_channels.h"
+
+// Binary Netpbm formats: P5 (PGM), P6 (PPM), and P7 (PAM, 1-4 channels)
+struct pnm_header {
+	int		format;		// 5, 6 or 7
+	int		width, height;
+	int		channels;	// 1-4
+	int		maxval;		// 1-65535; above 255 the samples are 16-bit big-endian
+};
+
+// Read a header, leaving the file at the first byte of pixel data. Returns 0, or -1 if
+// the file isn't a supported Netpbm file.
+int pnm_read_header(FILE *f, struct pnm_header *header);
+
+// Write a header in the same format. Returns 0, or -1 on an error.
+int pnm_write_header(FILE *f, const struct pnm_header *header);
+
+// Bytes per pixel of the pixel data (and of the image in memory)
+int pnm_bytes_per_pixel(const struct pnm_header *header);
+
+// Convert 16-bit samples between big-endian (in the file) and native order, in place
+// (byte swapping is its own inverse)
+void pnm_swap16(unsigned char *data, size_t bytes);
+
+// The adjusted values saturate at 255 or 65535; clamp them to a smaller maxval
+// (native byte order)
+void pnm_clamp(unsigned char *data, size_t bytes, int maxval);
+
+// Copy the pixel data from 'in' to 'out', adjusting it with 'plan' (created with
+// ADJUST_PLAN_16BIT if maxval > 255), in strips of 'rows' rows, with reading,
+// adjusting and writing on separate threads. Returns 0, or -1 on a read or write error.
+int pnm_stream_adjust(FILE *in, FILE *out, const struct pnm_header *header,
+	const struct adjust_plan *plan, int rows);
+
+#endif
@@ -0,0 +1,96 @@
+/*
+
+        insn-mem :: qemu TCG plugin that counts instructions and memory traffic
+        
+        Counts every guest instruction executed, and the number of bytes
+        loaded and stored, and writes the totals when the program exits:
+        
+                insns 123456
+                loaded 7890
+                stored 7890
+        
+        The counts are deterministic (they don't depend on the host or on
+        timing), so they can be compared across SVE vector lengths and
+        implementations. Usage:
+        
+                qemu-aarch64 -plugin ./libinsn-mem.so,outfile=counts.txt ./program
+        
+        Without outfile= the totals are written to stderr.
+        
+        This plugin is built for the host (it is loaded by qemu), not for
+        the guest. Vector loads and stores done by helpers (e.g. SVE LD3B)
+        are only reported to plugins by reasonably recent versions of qemu.
+        
+        Copyright (C)2022 Seneca College of Applied Arts and Technology
+        Written by Chris Tyler
+        Distributed under the terms of the GNU GPL v2
+        
+*/
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <qemu-plugin.h>
+
+QEMU_PLUGIN_EXPORT int qemu_plugin_version = QEMU_PLUGIN_VERSION;
+
+static uint64_t insns;
+static uint64_t loaded;
+static uint64_t stored;
+static const char *outfile;
+
+// Called each time a translation block executes; userdata is its instruction count
+static void tb_exec(unsigned int vcpu_index, void *userdata) {
+	__atomic_fetch_add(&insns, (uint64_t)(uintptr_t)userdata, __ATOMIC_RELAXED);
+}
+
+// Called for each memory access
+static void mem_access(unsigned int vcpu_index, qemu_plugin_meminfo_t info,
+	uint64_t vaddr, void *userdata) {
+
+	uint64_t bytes = 1 << qemu_plugin_mem_size_shift(info);
+
+	if (qemu_plugin_mem_is_store(info)) {
+		__atomic_fetch_add(&stored, bytes, __ATOMIC_RELAXED);
+	} else {
+		__atomic_fetch_add(&loaded, bytes, __ATOMIC_RELAXED);
+	}
+}
+
+// Called when a translation block is translated: attach the callbacks
+static void tb_trans(qemu_plugin_id_t id, struct qemu_plugin_tb *tb) {
+	size_t n = qemu_plugin_tb_n_insns(tb);
+
+	qemu_plugin_register_vcpu_tb_exec_cb(tb, tb_exec, QEMU_PLUGIN_CB_NO_REGS, (void *)(uintptr_t)n);
+	for (size_t i = 0; i < n; i++) {
+		qemu_plugin_register_vcpu_mem_cb(qemu_plugin_tb_get_insn(tb, i), mem_access,
+			QEMU_PLUGIN_CB_NO_REGS, QEMU_PLUGIN_MEM_RW, NULL);
+	}
+}
+
+static void plugin_exit(qemu_plugin_id_t id, void *userdata) {
+	FILE *out = outfile != NULL ? fopen(outfile, "w") : NULL;
+
+	fprintf(out != NULL ? out : stderr, "insns %llu\nloaded %llu\nstored %llu\n",
+		(unsigned long long)insns, (unsigned long long)loaded, (unsigned long long)stored);
+	if (out != NULL) {
+		fclose(out);
+	}
+}
+
+QEMU_PLUGIN_EXPORT int qemu_plugin_install(qemu_plugin_id_t id, const qemu_info_t *info,
+	int argc, char **argv) {
+
+	for (int i = 0; i < argc; i++) {
+		if (strncmp(argv[i], "outfile=", 8) == 0) {
+			outfile = argv[i] + 8;
+		} else {
+			fprintf(stderr, "insn-mem: unknown option '%s'\n", argv[i]);
+			return -1;
+		}
+	}
+	qemu_plugin_register_vcpu_tb_trans_cb(id, tb_trans);
+	qemu_plugin_register_atexit_cb(id, plugin_exit, NULL);
+	return 0;
+}
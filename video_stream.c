@@ -0,0 +1,363 @@
+/*
+
+        video_stream :: adjust raw video frames from a pipe, for per-frame grading
+
+        A raw video stream (e.g. "ffmpeg -f rawvideo -pix_fmt rgb24") is just
+        frames of width x height x 3 bytes, one after another, with no header.
+        Each frame is adjusted with the factors from a keyframe schedule,
+        interpolated over time, and written out in the same format, so
+        image-adjust can sit in a pipeline between two ffmpeg processes:
+
+                ffmpeg -i in.mp4 -f rawvideo -pix_fmt rgb24 - |
+                        image-adjust --video=3840x2160 --keyframes=grade.txt |
+                        ffmpeg -f rawvideo -pix_fmt rgb24 -s 3840x2160 -r 60 -i - out.mp4
+
+        As in pnm_stream.c, three stages run at once and pass frames around a
+        ring of buffers, here of whole frames:
+
+                reader  (worker thread)         read() a frame into an empty buffer
+                adjust  (calling thread)        adjust_plan_execute() on the frame,
+                                                itself spread over the thread pool
+                writer  (worker thread)         write() the frame, and hand the
+                                                buffer back to the reader
+
+        With more than three buffers, the reader can run ahead of the other
+        stages to absorb jitter in the producer. A 4K frame is 24MB, so the
+        buffers come from adjust_alloc() (huge pages, fewer TLB misses) and
+        are read and written whole, in as few system calls as the pipes
+        allow: the pipes are enlarged with F_SETPIPE_SZ where possible, which
+        raises the bytes moved per read() or write() from 64KB to (by
+        default) 1MB. (splice() can't be used: every frame is changed on the
+        way through, so its bytes have to pass through this process.)
+
+        The plan is only made again when the factors change from one frame
+        to the next, so a constant grade costs nothing per frame.
+
+        Copyright (C)2022 Seneca College of Applied Arts and Technology
+        Written by Chris Tyler
+        Distributed under the terms of the GNU GPL v2
+
+*/
+
+#define _GNU_SOURCE				// for F_SETPIPE_SZ
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "adjust_channels.h"
+#include "video_stream.h"
+
+#define PIPE_BYTES		(1024 * 1024)	// pipe size to ask for (the default /proc/sys/fs/pipe-max-size)
+
+// ==================== Keyframes
+
+int video_read_keyframes(const char *path, struct video_keyframe **keys) {
+	FILE *f = fopen(path, "r");
+	struct video_keyframe *k = NULL;
+	char line[256];
+	int count = 0, number = 0;
+
+	if (f == NULL) {
+		dprintf(2, "Could not open keyframe file '%s'.\n", path);
+		return -1;
+	}
+	while (fgets(line, sizeof(line), f) != NULL) {
+		struct video_keyframe key;
+		char *text = line + strspn(line, " \t");
+
+		number++;
+		if (*text == '#' || *text == '\n' || *text == '\0') {
+			continue;
+		}
+		if (sscanf(text, "%ld %f %f %f", &key.frame, &key.red, &key.green, &key.blue) != 4 ||
+		    key.frame < 0 || (count > 0 && key.frame <= k[count - 1].frame)) {
+			dprintf(2, "%s:%d: expected 'frame red green blue', in increasing frame order.\n",
+				path, number);
+			free(k);
+			fclose(f);
+			return -1;
+		}
+		if ((count & (count - 1)) == 0) {	// grow at each power of two
+			struct video_keyframe *more = realloc(k, sizeof(*k) * (count ? count * 2 : 1));
+
+			if (more == NULL) {
+				free(k);
+				fclose(f);
+				return -1;
+			}
+			k = more;
+		}
+		key.red   = key.red   < 0 ? 0 : key.red   > 2 ? 2 : key.red;
+		key.green = key.green < 0 ? 0 : key.green > 2 ? 2 : key.green;
+		key.blue  = key.blue  < 0 ? 0 : key.blue  > 2 ? 2 : key.blue;
+		k[count++] = key;
+	}
+	fclose(f);
+	if (count == 0) {
+		dprintf(2, "No keyframes in '%s'.\n", path);
+		return -1;
+	}
+	*keys = k;
+	return count;
+}
+
+void video_factors(const struct video_keyframe *keys, int count, long frame, float factors[3]) {
+	int next = 0;
+
+	while (next < count && keys[next].frame <= frame) {
+		next++;
+	}
+
+	const struct video_keyframe *a = &keys[next > 0 ? next - 1 : 0];
+	const struct video_keyframe *b = &keys[next < count ? next : count - 1];
+	float t = b->frame > a->frame ? (float)(frame - a->frame) / (b->frame - a->frame) : 0;
+
+	factors[0] = a->red   + (b->red   - a->red)   * t;
+	factors[1] = a->green + (b->green - a->green) * t;
+	factors[2] = a->blue  + (b->blue  - a->blue)  * t;
+}
+
+// ==================== Streaming
+
+enum { EMPTY, READ, ADJUSTED };			// state of a buffer: the stage that last finished with it
+
+struct video {
+	int			in, out;
+	int			width, height;
+	size_t			frame_bytes;
+	int			buffers;
+	double			fps;
+	struct video_stats	*stats;
+	struct timespec		start;		// when the first frame had been read
+
+	pthread_mutex_t		lock;
+	pthread_cond_t		changed;	// broadcast whenever a buffer changes state
+	int			failed;		// set by any stage on an error, to stop the others
+	uint64_t		end;		// frames in the input, once the reader has found its end
+
+	struct {
+		unsigned char	*data;
+		int		state;
+	} *buffer;
+};
+
+static double ms_since(const struct timespec *start) {
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (now.tv_sec - start->tv_sec) * 1e3 + (now.tv_nsec - start->tv_nsec) / 1e6;
+}
+
+// Wait until frame's buffer is in 'state' (returns 0), or until a stage has failed or
+// the input has ended before 'frame' (returns -1)
+static int wait_for(struct video *v, uint64_t frame, int state) {
+	int result;
+
+	pthread_mutex_lock(&v->lock);
+	while (!v->failed && frame < v->end && v->buffer[frame % v->buffers].state != state) {
+		pthread_cond_wait(&v->changed, &v->lock);
+	}
+	result = v->failed || frame >= v->end ? -1 : 0;
+	pthread_mutex_unlock(&v->lock);
+	return result;
+}
+
+// Put frame's buffer into 'state', or flag a failure if 'ok' is zero
+static void hand_on(struct video *v, uint64_t frame, int state, int ok) {
+	pthread_mutex_lock(&v->lock);
+	if (ok) {
+		v->buffer[frame % v->buffers].state = state;
+	} else {
+		v->failed = 1;
+	}
+	pthread_cond_broadcast(&v->changed);
+	pthread_mutex_unlock(&v->lock);
+}
+
+// Read up to 'bytes', stopping early only at the end of the input. Returns the number
+// of bytes read, or -1 on an error.
+static ssize_t read_frame(struct video *v, unsigned char *data, size_t bytes) {
+	size_t done = 0;
+
+	while (done < bytes) {
+		ssize_t n = read(v->in, data + done, bytes - done);
+
+		v->stats->reads++;
+		if (n == 0) {
+			break;
+		}
+		if (n < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			return -1;
+		}
+		done += n;
+	}
+	return done;
+}
+
+static int write_frame(struct video *v, const unsigned char *data, size_t bytes) {
+	size_t done = 0;
+
+	while (done < bytes) {
+		ssize_t n = write(v->out, data + done, bytes - done);
+
+		v->stats->writes++;
+		if (n < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			return -1;
+		}
+		done += n;
+	}
+	return 0;
+}
+
+static void *reader(void *arg) {
+	struct video *v = arg;
+
+	for (uint64_t frame = 0; ; frame++) {
+		struct timespec wait;
+
+		clock_gettime(CLOCK_MONOTONIC, &wait);
+		if (wait_for(v, frame, EMPTY) != 0) {
+			break;
+		}
+		if (frame >= (uint64_t)v->buffers) {
+			v->stats->buffer_wait_ms += ms_since(&wait);
+		}
+
+		ssize_t bytes = read_frame(v, v->buffer[frame % v->buffers].data, v->frame_bytes);
+
+		if (frame == 0) {
+			clock_gettime(CLOCK_MONOTONIC, &v->start);
+		}
+		if (bytes != (ssize_t)v->frame_bytes) {
+			pthread_mutex_lock(&v->lock);
+			v->end = frame;
+			v->failed |= bytes < 0;
+			v->stats->discarded = bytes > 0 ? bytes : 0;
+			pthread_cond_broadcast(&v->changed);
+			pthread_mutex_unlock(&v->lock);
+			break;
+		}
+		hand_on(v, frame, READ, 1);
+	}
+	return NULL;
+}
+
+static void *writer(void *arg) {
+	struct video *v = arg;
+
+	for (uint64_t frame = 0; ; frame++) {
+		if (wait_for(v, frame, ADJUSTED) != 0) {
+			break;
+		}
+
+		int ok = write_frame(v, v->buffer[frame % v->buffers].data, v->frame_bytes) == 0;
+
+		if (ok) {
+			double ms = ms_since(&v->start);
+
+			v->stats->frames++;
+			v->stats->seconds = ms / 1e3;
+			if (v->fps > 0 && ms > (frame + 1) * 1e3 / v->fps) {
+				v->stats->late++;
+			}
+		}
+		hand_on(v, frame, EMPTY, ok);
+	}
+	return NULL;
+}
+
+int video_stream_adjust(int in, int out, int width, int height, const struct video_keyframe *keys,
+	int count, int plan_flags, double fps, int buffers, struct video_stats *stats) {
+
+	struct video v = { in, out, width, height, (size_t)width * height * 3, buffers < 3 ? 3 : buffers, fps, stats };
+	pthread_t read_thread, write_thread;
+	struct adjust_plan *plan = NULL;
+	float current[3] = { -1, -1, -1 };
+	int failed;
+
+	memset(stats, 0, sizeof(*stats));
+	v.end = UINT64_MAX;
+	pthread_mutex_init(&v.lock, NULL);
+	pthread_cond_init(&v.changed, NULL);
+#ifdef F_SETPIPE_SZ
+	fcntl(in, F_SETPIPE_SZ, PIPE_BYTES);		// fails harmlessly if not a pipe
+	fcntl(out, F_SETPIPE_SZ, PIPE_BYTES);
+#endif
+
+	v.buffer = calloc(v.buffers, sizeof(*v.buffer));
+	v.failed = v.buffer == NULL;
+	for (int b = 0; !v.failed && b < v.buffers; b++) {
+		v.buffer[b].data = adjust_alloc(v.frame_bytes, 0);
+		v.buffer[b].state = EMPTY;
+		v.failed = v.buffer[b].data == NULL;
+	}
+	if (!v.failed) {
+		int reading = pthread_create(&read_thread, NULL, reader, &v) == 0;
+		int writing = reading && pthread_create(&write_thread, NULL, writer, &v) == 0;
+
+		// A stage that couldn't be started fails the stream (and stops the other)
+		if (!writing) {
+			hand_on(&v, 0, EMPTY, 0);
+		}
+		for (uint64_t frame = 0; ; frame++) {
+			struct timespec wait, start;
+			float factors[3];
+
+			clock_gettime(CLOCK_MONOTONIC, &wait);
+			if (wait_for(&v, frame, READ) != 0) {
+				break;
+			}
+			if (frame > 0) {
+				stats->input_wait_ms += ms_since(&wait);
+			}
+			clock_gettime(CLOCK_MONOTONIC, &start);
+
+			video_factors(keys, count, frame, factors);
+			if (plan == NULL || memcmp(factors, current, sizeof(current)) != 0) {
+				adjust_plan_destroy(plan);
+				plan = adjust_plan_create(factors[0], factors[1], factors[2], 3, plan_flags);
+				memcpy(current, factors, sizeof(current));
+			}
+			if (plan != NULL) {
+				adjust_plan_execute(plan, v.buffer[frame % v.buffers].data, width, height);
+			}
+
+			double ms = ms_since(&start);
+
+			stats->adjusted++;
+			stats->adjust_sum_ms += ms;
+			stats->adjust_max_ms = ms > stats->adjust_max_ms ? ms : stats->adjust_max_ms;
+			hand_on(&v, frame, ADJUSTED, plan != NULL);
+		}
+
+		if (reading) {
+			pthread_join(read_thread, NULL);
+		}
+		if (writing) {
+			pthread_join(write_thread, NULL);
+		}
+	}
+
+	failed = v.failed;
+	adjust_plan_destroy(plan);
+	for (int b = 0; v.buffer != NULL && b < v.buffers; b++) {
+		adjust_free(v.buffer[b].data);
+	}
+	free(v.buffer);
+	pthread_cond_destroy(&v.changed);
+	pthread_mutex_destroy(&v.lock);
+	return failed ? -1 : 0;
+}
@@ -0,0 +1,47 @@
+// video_stream.h
+
+#ifndef VIDEO_STREAM_H
+#define VIDEO_STREAM_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// The factors to use from a given frame on (see video_read_keyframes())
+struct video_keyframe {
+	long		frame;
+	float		red, green, blue;
+};
+
+// Read a keyframe schedule: one "frame red green blue" per line, in increasing frame
+// order, with blank lines and # comments ignored. Returns the number of keyframes (with
+// *keys set to a malloc()ed array), or -1 with a message on stderr if the file can't be
+// read or is malformed.
+int video_read_keyframes(const char *path, struct video_keyframe **keys);
+
+// The factors for frame 'frame': linear interpolation between the keyframes either side
+// of it, or the first or last keyframe's factors before or after them
+void video_factors(const struct video_keyframe *keys, int count, long frame, float factors[3]);
+
+struct video_stats {
+	uint64_t	frames;		// complete frames adjusted and written
+	size_t		discarded;	// bytes of a partial frame at the end of the input
+	uint64_t	late;		// frames written after their deadline (if fps > 0)
+	uint64_t	reads, writes;	// system calls
+	double		seconds;	// from the first frame read to the last written
+	double		adjust_max_ms;	// longest time to adjust one frame
+	double		adjust_sum_ms;	// ... and in total, over 'adjusted' frames
+	uint64_t	adjusted;
+	double		input_wait_ms;	// time the adjusting thread waited for a frame to be read
+	double		buffer_wait_ms;	// time the reader waited for a free buffer (adjusting or output behind)
+};
+
+// Adjust raw RGB (rgb24) frames of width x height from 'in' to 'out' (file descriptors),
+// with the factors for each frame taken from 'keys' and plans made with 'plan_flags',
+// using 'buffers' frame buffers shared by a reading, an adjusting and a writing thread.
+// If fps > 0, frame n (from 0) is late if it is written more than (n + 1) / fps seconds
+// after the first frame was read. Returns 0, or -1 on a read or write error; 'stats' is
+// filled in either way.
+int video_stream_adjust(int in, int out, int width, int height, const struct video_keyframe *keys,
+	int count, int plan_flags, double fps, int buffers, struct video_stats *stats);
+
+#endif